@@ -13,6 +13,9 @@
 
   Corresponding author e-mail: kondorskiy@lebedev.ru, kondorskiy@gmail.com.
 
+  Compilation requires C++17 and threads, e.g.: g++ -O2 -std=c++17 -pthread triangle.cpp -o triangle
+  The binary result format and its reader for other programs are in triangle_result.h.
+
 ======================================================================================================================*/
 
 #include <stdio.h>
@@ -21,389 +24,6437 @@
 #include <iostream>
 #include <string>
 #include <complex>
+#include <algorithm>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <deque>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <chrono>
+#include <charconv>
+#include <string.h>
 #include <math.h>
+#include <float.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "triangle_result.h"
+
+#if defined(__GNUC__)
+#define TRIANGLE_INLINE inline __attribute__((always_inline))
+#else
+#define TRIANGLE_INLINE inline
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TRIANGLE_X86_DISPATCH 1             // Runtime selection of SSE2/AVX2/AVX-512 kernels.
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define TRIANGLE_IO_URING 1                 // io_uring output backend.
+#endif
+#endif
+
+#if defined(TRIANGLE_IO_URING)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
 
 
 /***********************************************************************************************************************
-  The analytical model for prism with equilateral triangle base.
+  Forward-mode automatic differentiation.
+
+  The scalar model functions (shape fits, polarizability, cross sections, table interpolation and dielectric
+  functions) are templates on the scalar type T. With T = double they are the usual functions; with T = Dual<N>
+  every number carries its derivatives by N seeded variables, so one evaluation gives the value and the gradient.
 ***********************************************************************************************************************/
 
 /*----------------------------------------------------------------------------------------------------------------------
-  Dipole polarizability in nm^3.
+  Dual number with N derivative components. Comparisons use the value only, so table lookups and branches follow
+  the value, and the derivative is that of the branch taken.
 ----------------------------------------------------------------------------------------------------------------------*/
-std::complex<double> dipPolariz(
-  const double &lambda,                     // Wavelength in nm.
-  const std::complex<double> &eps_m,        // Dielectric permittivity of material.
-  const double &eps_h,                      // Dielectric permittivity of host media.
-  const double &L,                          // Edge length in nm.
-  const double &H,                          // Thickness in nm.
-  const double &R )                         // Triangle base corner radius in nm.
+template <int N>
+struct Dual
 {
-  const std::complex<double> IRE(1.0, 0.0);
-  const std::complex<double> IIM(0.0, 1.0);
+  double v;                                 // Value.
+  double d[N];                              // Derivatives by the seeded variables.
+
+  Dual() : v(0.0), d() {}
+
+  // Constant.
+  Dual(const double &x) : v(x), d() {}
+
+  // Variable number k.
+  Dual(const double &x, const int &k) : v(x), d() { d[k] = 1.0; }
 
-  double beta = -0.649487*pow(L/H, -1.27802) + 1.87718*pow(L/R, -0.928178) + 0.0784606*pow(H/R, -0.619604) + 0.617065;
-  double eps_c = -1.73983*pow(L/H, 0.904851) + 23.7005*pow(L/R, -9.71985) + 3.73666*pow(H/R, -0.416187) - 4.23387;
-  double a2 = 1.35181*pow(L/H, -0.556507) + 1.13818*pow(L/R, -0.483608) - 0.287856*pow(H/R, -0.468685) - 0.0564038;
-  double a4 = -2.58813*pow(L/H, -0.447242) - 2.62882*pow(L/R, -2.97322) - 0.254773*pow(H/R, -0.125501) + 0.702526;
+  Dual &operator+=(const Dual &b) { v += b.v; for (int k = 0; k < N; ++k) d[k] += b.d[k]; return *this; }
+  Dual &operator-=(const Dual &b) { v -= b.v; for (int k = 0; k < N; ++k) d[k] -= b.d[k]; return *this; }
+  Dual &operator*=(const Dual &b)
+  {
+    for (int k = 0; k < N; ++k) d[k] = d[k]*b.v + v*b.d[k];
+    v *= b.v;
+    return *this;
+  }
+  Dual &operator/=(const Dual &b)
+  {
+    v /= b.v;
+    for (int k = 0; k < N; ++k) d[k] = (d[k] - v*b.d[k])/b.v;
+    return *this;
+  }
+};
 
-  double s = std::sqrt(eps_h)*L/lambda;
-  double V0 = 0.25*std::sqrt(3.0)*L*L*H;
-  double V1 = V0*beta;
+template <int N> inline Dual<N> operator+(Dual<N> a, const Dual<N> &b) { return a += b; }
+template <int N> inline Dual<N> operator-(Dual<N> a, const Dual<N> &b) { return a -= b; }
+template <int N> inline Dual<N> operator*(Dual<N> a, const Dual<N> &b) { return a *= b; }
+template <int N> inline Dual<N> operator/(Dual<N> a, const Dual<N> &b) { return a /= b; }
+template <int N> inline Dual<N> operator+(Dual<N> a, const double &b) { a.v += b; return a; }
+template <int N> inline Dual<N> operator-(Dual<N> a, const double &b) { a.v -= b; return a; }
+template <int N> inline Dual<N> operator+(const double &a, Dual<N> b) { b.v += a; return b; }
+template <int N> inline Dual<N> operator-(const double &a, const Dual<N> &b) { return Dual<N>(a) -= b; }
+template <int N> inline Dual<N> operator/(const double &a, const Dual<N> &b) { return Dual<N>(a) /= b; }
+template <int N> inline Dual<N> operator+(const Dual<N> &a) { return a; }
+template <int N> inline Dual<N> operator-(const Dual<N> &a) { return Dual<N>(0.0) -= a; }
 
-  std::complex<double> Arc = IRE*s*s*a2 + 4.0*M_PI*M_PI*IIM*V1*s*s*s/(3.0*L*L*L) + IRE*s*s*s*s*a4;
-  return (1.0/(4.0*M_PI))*V1/( IRE/(eps_m/eps_h - IRE) - IRE/(eps_c - 1.0) - Arc );
+template <int N>
+inline Dual<N> operator*(Dual<N> a, const double &b)
+{
+  a.v *= b;
+  for (int k = 0; k < N; ++k) a.d[k] *= b;
+  return a;
 }
 
+template <int N> inline Dual<N> operator*(const double &a, const Dual<N> &b) { return b*a; }
+template <int N> inline Dual<N> operator/(const Dual<N> &a, const double &b) { return a*(1.0/b); }
 
-/*----------------------------------------------------------------------------------------------------------------------
-  Scattering cross section in cm^2.
-----------------------------------------------------------------------------------------------------------------------*/
-double scatCSdip(
-  const double &lambda,                     // Wavelength in nm.
-  const std::complex<double> &eps_m,        // Dielectric permittivity of material.
-  const double &eps_h,                      // Dielectric permittivity of host media.
-  const double &L,                          // Edge length in nm.
-  const double &H,                          // Thickness in nm.
-  const double &R )                         // Triangle base corner radius in nm.
+template <int N> inline bool operator<(const Dual<N> &a, const Dual<N> &b) { return a.v < b.v; }
+template <int N> inline bool operator<(const Dual<N> &a, const double &b) { return a.v < b; }
+template <int N> inline bool operator<(const double &a, const Dual<N> &b) { return a < b.v; }
+template <int N> inline bool operator>(const Dual<N> &a, const Dual<N> &b) { return a.v > b.v; }
+template <int N> inline bool operator>(const Dual<N> &a, const double &b) { return a.v > b; }
+template <int N> inline bool operator>(const double &a, const Dual<N> &b) { return a > b.v; }
+template <int N> inline bool operator==(const Dual<N> &a, const Dual<N> &b) { return a.v == b.v; }
+template <int N> inline bool operator!=(const Dual<N> &a, const Dual<N> &b) { return a.v != b.v; }
+
+// Function f(x) with the derivative f'(x) = df.
+template <int N>
+inline Dual<N> chain(
+  const Dual<N> &x,                         // Argument.
+  const double &f,                          // Value of the function.
+  const double &df)                         // Derivative of the function.
 {
-  std::complex<double> polariz = dipPolariz( lambda, eps_m, eps_h, L, H, R );
-  double k = 2.0*M_PI*std::sqrt(eps_h)/lambda;
-  return 8.0*M_PI*std::pow(k, 4)*std::pow(std::abs(polariz), 2)*1.0e-14/3.0;
+  Dual<N> r(f);
+  for (int k = 0; k < N; ++k) r.d[k] = df*x.d[k];
+  return r;
+}
+
+template <int N> inline Dual<N> sqrt(const Dual<N> &x) { double s = ::sqrt(x.v); return chain(x, s, 0.5/s); }
+template <int N> inline Dual<N> exp(const Dual<N> &x) { double e = ::exp(x.v); return chain(x, e, e); }
+template <int N> inline Dual<N> log(const Dual<N> &x) { return chain(x, ::log(x.v), 1.0/x.v); }
+template <int N> inline Dual<N> fabs(const Dual<N> &x) { return (x.v < 0.0) ? -x : x; }
+
+template <int N>
+inline Dual<N> pow(
+  const Dual<N> &x,                         // Base.
+  const double &p)                          // Exponent.
+{
+  return chain(x, ::pow(x.v, p), p*::pow(x.v, p - 1.0));
 }
 
+// Value of a number without its derivatives.
+inline double scalarValue(const double &x) { return x; }
+template <int N> inline double scalarValue(const Dual<N> &x) { return x.v; }
 
 /*----------------------------------------------------------------------------------------------------------------------
-  Extinction cross section in cm^2.
+  Complex number of dual parts. std::complex is specified for float, double and long double only, so the dual
+  model functions use this one, with the few operations they need in the textbook formulas.
 ----------------------------------------------------------------------------------------------------------------------*/
-double extCSdip(
-  const double &lambda,                     // Wavelength in nm.
-  const std::complex<double> &eps_m,        // Dielectric permittivity of material.
-  const double &eps_h,                      // Dielectric permittivity of host media.
-  const double &L,                          // Edge length in nm.
-  const double &H,                          // Thickness in nm.
-  const double &R )                         // Triangle base corner radius in nm.
+template <class T>
+struct Complex
 {
-  std::complex<double> polariz = dipPolariz( lambda, eps_m, eps_h, L, H, R );
-  double k = 2.0*M_PI*std::sqrt(eps_h)/lambda;
-  return 4.0*M_PI*k*std::imag(polariz)*1.0e-14;
+  T re;                                     // Real part.
+  T im;                                     // Imaginary part.
+
+  Complex() : re(), im() {}
+  Complex(const T &x, const T &y) : re(x), im(y) {}
+};
+
+template <class T> inline T real(const Complex<T> &z) { return z.re; }
+template <class T> inline T imag(const Complex<T> &z) { return z.im; }
+template <class T> inline T norm(const Complex<T> &z) { return z.re*z.re + z.im*z.im; }
+
+template <class T>
+inline T abs(const Complex<T> &z)
+{
+  T s = (fabs(z.re) < fabs(z.im)) ? fabs(z.im) : fabs(z.re);
+  if (s == T(0.0)) return s;
+  T x = z.re/s, y = z.im/s;
+  return s*sqrt(x*x + y*y);
+}
+
+template <class T>
+inline Complex<T> operator+(const Complex<T> &a, const Complex<T> &b) { return Complex<T>(a.re + b.re, a.im + b.im); }
+template <class T>
+inline Complex<T> operator-(const Complex<T> &a, const Complex<T> &b) { return Complex<T>(a.re - b.re, a.im - b.im); }
+template <class T>
+inline Complex<T> operator*(const Complex<T> &a, const Complex<T> &b)
+{
+  return Complex<T>(a.re*b.re - a.im*b.im, a.re*b.im + a.im*b.re);
+}
+template <class T>
+inline Complex<T> operator/(const Complex<T> &a, const Complex<T> &b)
+{
+  T n = norm(b);
+  return Complex<T>((a.re*b.re + a.im*b.im)/n, (a.im*b.re - a.re*b.im)/n);
 }
+template <class T> inline Complex<T> operator*(const Complex<T> &a, const T &b) { return Complex<T>(a.re*b, a.im*b); }
+template <class T> inline Complex<T> operator*(const T &a, const Complex<T> &b) { return Complex<T>(a*b.re, a*b.im); }
+
+// Number types of the templated model functions; other arithmetic arguments go to their double overloads.
+template <class T> struct ModelNumber {};
+template <> struct ModelNumber<double> { typedef double type; typedef std::complex<double> complex; };
+template <int N> struct ModelNumber<Dual<N> > { typedef Dual<N> type; typedef Complex<Dual<N> > complex; };
 
 
 /***********************************************************************************************************************
-  Dielectric functions of silver and gold.
+  The analytical model for prism with equilateral triangle base.
 ***********************************************************************************************************************/
 
 /*----------------------------------------------------------------------------------------------------------------------
-  Interpolation procedure.
+  Power-law fits of the shape coefficients beta, eps_c, a2 and a4 of the model:
+    c = a1*(L/H)^p1 + a2*(L/R)^p2 + a3*(H/R)^p3 + a0.
 ----------------------------------------------------------------------------------------------------------------------*/
-double interpolate(
-  const int &n,                             // Size of arrays.
-  const double x_arr[],                     // Array of arguments.
-  const double y_arr[],                     // Array of function values.
-  const double &x_val)                      // Argument value to interpolate for.
+struct ShapeFit
 {
-  int i = 0;
-  bool flag = true;
-  for (int j = 1; j < n; ++j)
-    if (flag && (x_arr[j] > x_val)) {
-      i = j - 1;
-      flag = false;
-    }
-  if(i < 1) i = 1;
-  if(i > n - 3) i = n - 3;
+  double a1, p1;                            // Term in L/H.
+  double a2, p2;                            // Term in L/R.
+  double a3, p3;                            // Term in H/R.
+  double a0;                                // Constant term.
+};
 
-  double x[4], y[4];
+constexpr ShapeFit shape_fit[4] = {
+  { -0.649487, -1.27802,   1.87718, -0.928178,   0.0784606, -0.619604,   0.617065 },      // beta
+  { -1.73983,   0.904851,  23.7005, -9.71985,    3.73666,   -0.416187,  -4.23387 },       // eps_c
+  {  1.35181,  -0.556507,  1.13818, -0.483608,  -0.287856,  -0.468685,  -0.0564038 },     // a2
+  { -2.58813,  -0.447242, -2.62882, -2.97322,   -0.254773,  -0.125501,   0.702526 } };    // a4
 
-  x[0] = x_arr[i - 1];  y[0] = y_arr[i - 1];
-  x[1] = x_arr[i];      y[1] = y_arr[i];
-  x[2] = x_arr[i + 1];  y[2] = y_arr[i + 1];
-  x[3] = x_arr[i + 2];  y[3] = y_arr[i + 2];
 
-  return (x_val - x[1])*(x_val - x[2])*(x_val - x[3])*y[0]/((x[0] - x[1])*(x[0] - x[2])*(x[0] - x[3]))
-       + (x_val - x[0])*(x_val - x[2])*(x_val - x[3])*y[1]/((x[1] - x[0])*(x[1] - x[2])*(x[1] - x[3]))
-       + (x_val - x[0])*(x_val - x[1])*(x_val - x[3])*y[2]/((x[2] - x[0])*(x[2] - x[1])*(x[2] - x[3]))
-       + (x_val - x[0])*(x_val - x[1])*(x_val - x[2])*y[3]/((x[3] - x[0])*(x[3] - x[1])*(x[3] - x[2]));
+/*----------------------------------------------------------------------------------------------------------------------
+  Constants of the polarizability formula for a given geometry and host medium.
+----------------------------------------------------------------------------------------------------------------------*/
+template <class T>
+struct PolarizCoefT
+{
+  T sL;                                     // sqrt(eps_h)*L, so that s = sL/lambda.
+  T eps_h;                                  // Dielectric permittivity of host media.
+  T pref;                                   // V1/(4 pi).
+  T inv_ec1;                                // 1/(eps_c - 1).
+  T a2, a4;                                 // Fitted shape coefficients.
+  T c3;                                     // 4 pi^2 V1/(3 L^3), radiative damping coefficient.
+};
+
+typedef PolarizCoefT<double> PolarizCoef;
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Polarizability formula in real arithmetic. T is double or a GCC vector of doubles, so the scalar path and all
+  SIMD kernels evaluate exactly the same sequence of operations. The constants C are either shared by all lanes
+  (double) or given per lane (C = T) when the lanes hold different particles.
+----------------------------------------------------------------------------------------------------------------------*/
+template <class C, class T>
+static TRIANGLE_INLINE void polarizLane(
+  const PolarizCoefT<C> &c,                 // Constants of the formula.
+  const T &lambda,                          // Wavelength in nm.
+  const T &eps_re,                          // Real part of permittivity of material.
+  const T &eps_im,                          // Imaginary part of permittivity of material.
+  T &alpha_re,                              // Output: real part of polarizability in nm^3.
+  T &alpha_im)                              // Output: imaginary part of polarizability in nm^3.
+{
+  T s = c.sL/lambda;
+  T s2 = s*s;
+
+  // 1/(eps_m/eps_h - 1) - 1/(eps_c - 1) - Arc.
+  T qr = eps_re/c.eps_h - 1.0;
+  T qi = eps_im/c.eps_h;
+  T qn = qr*qr + qi*qi;
+  T dr = qr/qn - c.inv_ec1 - s2*(c.a2 + s2*c.a4);
+  T di = -qi/qn - c.c3*s2*s;
+
+  T dn = dr*dr + di*di;
+  alpha_re = c.pref*dr/dn;
+  alpha_im = -c.pref*di/dn;
 }
 
 
 /*----------------------------------------------------------------------------------------------------------------------
-  Dielectric function of silver from [Johnson P.B., Christy R.W. Phys. Rev. B, 6, 470 (1972).]
+  Prism geometry with the shape coefficients of the model precomputed.
+
+  The fitted coefficients beta, eps_c, a2 and a4 depend only on L, H and R, so they are evaluated once on
+  construction and the per-wavelength evaluation reduces to a few real multiplications and two divisions.
 ----------------------------------------------------------------------------------------------------------------------*/
-std::complex<double> epsAg(
-  const double &lambda)                     // Wavelength in nm.
+class PrismModel
 {
-  const std::complex<double> IRE(1.0, 0.0);
-  const std::complex<double> IIM(0.0, 1.0);
+public:
 
-  const int num = 49;
-  const double energy[] = { 0.64, 0.77, 0.89, 1.02, 1.14, 1.26, 1.39, 1.51, 1.64, 1.76,
-                            1.88, 2.01, 2.13, 2.26, 2.38, 2.50, 2.63, 2.75, 2.88, 3.00,
-                            3.12, 3.25, 3.37, 3.50, 3.62, 3.74, 3.87, 3.99, 4.12, 4.24,
-                            4.36, 4.49, 4.61, 4.74, 4.86, 4.98, 5.11, 5.23, 5.36, 5.48,
-                            5.60, 5.73, 5.85, 5.98, 6.10, 6.22, 6.35, 6.47, 6.60 };
+  PrismModel(
+    const double &L,                        // Edge length in nm.
+    const double &H,                        // Thickness in nm.
+    const double &R );                      // Triangle base corner radius in nm.
 
-  const double ndata[]  = { 0.24, 0.15, 0.13, 0.09, 0.04, 0.04, 0.04, 0.04, 0.03, 0.04,
-                            0.05, 0.06, 0.05, 0.06, 0.05, 0.05, 0.05, 0.04, 0.04, 0.05,
-                            0.05, 0.05, 0.07, 0.10, 0.14, 0.17, 0.81, 1.13, 1.34, 1.39,
-                            1.41, 1.41, 1.38, 1.35, 1.33, 1.31, 1.30, 1.28, 1.28, 1.26,
-                            1.25, 1.22, 1.20, 1.18, 1.15, 1.14, 1.12, 1.10, 1.07 };
+  // The same with the shape coefficients beta, eps_c, a2, a4 already evaluated.
+  PrismModel(
+    const double &L,                        // Edge length in nm.
+    const double &H,                        // Thickness in nm.
+    const double &R,                        // Triangle base corner radius in nm.
+    const double shape[4] );                // Shape coefficients beta, eps_c, a2, a4.
 
-  const double kdata[]  = { 14.080, 11.85, 10.10, 8.828, 7.795, 6.992, 6.312, 5.727, 5.242, 4.838,
-                            4.483, 4.152, 3.858, 3.586, 3.324, 3.093, 2.869, 2.657, 2.462, 2.275,
-                            2.070, 1.864, 1.657, 1.419, 1.142, 0.829, 0.392, 0.616, 0.964, 1.161,
-                            1.264, 1.331, 1.372, 1.387, 1.393, 1.389, 1.378, 1.367, 1.357, 1.344,
-                            1.342, 1.336, 1.325, 1.312, 1.296, 1.277, 1.255, 1.232, 1.212 };
+  // Dipole polarizability in nm^3.
+  std::complex<double> polariz(
+    const double &lambda,                   // Wavelength in nm.
+    const std::complex<double> &eps_m,      // Dielectric permittivity of material.
+    const double &eps_h ) const;            // Dielectric permittivity of host media.
 
-  double omega = 1239.8/lambda;
+  // Scattering cross section in cm^2.
+  double scatCS(
+    const double &lambda,                   // Wavelength in nm.
+    const std::complex<double> &eps_m,      // Dielectric permittivity of material.
+    const double &eps_h ) const;            // Dielectric permittivity of host media.
 
-  if ((omega < energy[0]) && (omega > energy[num - 1])) {
-    std::cout << "Argument of dielectric function of silver is out of range" << std::endl;
-    exit(0);
-  }
+  // Extinction cross section in cm^2.
+  double extCS(
+    const double &lambda,                   // Wavelength in nm.
+    const std::complex<double> &eps_m,      // Dielectric permittivity of material.
+    const double &eps_h ) const;            // Dielectric permittivity of host media.
+
+  // Polarizability and all cross sections at one wavelength from a single evaluation of alpha.
+  void crossSections(
+    const double &lambda,                   // Wavelength in nm.
+    const std::complex<double> &eps_m,      // Dielectric permittivity of material.
+    const double &eps_h,                    // Dielectric permittivity of host media.
+    std::complex<double> &alpha,            // Output: polarizability in nm^3.
+    double &c_sca,                          // Output: scattering cross section in cm^2.
+    double &c_ext,                          // Output: extinction cross section in cm^2.
+    double &c_abs ) const;                  // Output: absorption cross section in cm^2.
+
+  // The same for n wavelength points; output arrays are supplied by the caller, any of them may be NULL.
+  void spectrum(
+    const int &n,                           // Number of wavelength points.
+    const double lambda[],                  // Wavelengths in nm.
+    const std::complex<double> eps_m[],     // Dielectric permittivity of material at each wavelength.
+    const double &eps_h,                    // Dielectric permittivity of host media.
+    std::complex<double> alpha[],           // Output: polarizability in nm^3.
+    double c_sca[],                         // Output: scattering cross section in cm^2.
+    double c_ext[],                         // Output: extinction cross section in cm^2.
+    double c_abs[] ) const;                 // Output: absorption cross section in cm^2.
+
+  // Polarizability at n wavelength points with SIMD kernels chosen at runtime. Arrays are in structure-of-arrays
+  // layout; results agree with polariz() up to rounding of fused multiply-add where the CPU has it.
+  void polarizBatch(
+    const int &n,                           // Number of wavelength points.
+    const double lambda[],                  // Wavelengths in nm.
+    const double eps_re[],                  // Real part of permittivity of material.
+    const double eps_im[],                  // Imaginary part of permittivity of material.
+    const double &eps_h,                    // Dielectric permittivity of host media.
+    double alpha_re[],                      // Output: real part of polarizability in nm^3.
+    double alpha_im[] ) const;              // Output: imaginary part of polarizability in nm^3.
+
+  // Polarizability and cross sections at n wavelength points, structure-of-arrays counterpart of spectrum()
+  // built on polarizBatch(). c_sca, c_ext and c_abs may be NULL.
+  void spectrumBatch(
+    const int &n,                           // Number of wavelength points.
+    const double lambda[],                  // Wavelengths in nm.
+    const double eps_re[],                  // Real part of permittivity of material.
+    const double eps_im[],                  // Imaginary part of permittivity of material.
+    const double &eps_h,                    // Dielectric permittivity of host media.
+    double alpha_re[],                      // Output: real part of polarizability in nm^3.
+    double alpha_im[],                      // Output: imaginary part of polarizability in nm^3.
+    double c_sca[],                         // Output: scattering cross section in cm^2.
+    double c_ext[],                         // Output: extinction cross section in cm^2.
+    double c_abs[] ) const;                 // Output: absorption cross section in cm^2.
+
+  // Constants of the polarizability formula in the given host medium.
+  PolarizCoef coef(
+    const double &eps_h ) const;            // Dielectric permittivity of host media.
+
+  double edge() const { return L_; }
+  double thickness() const { return H_; }
+  double radius() const { return R_; }
+  double volume() const { return V0_; }
+
+private:
+
+  double L_, H_, R_;                        // Geometry in nm.
+  double beta_, eps_c_, a2_, a4_;           // Fitted shape coefficients.
+  double V0_, V1_;                          // Prism volume and effective volume in nm^3.
 
-  double n_val = interpolate(num, energy, ndata, omega);
-  double k_val = interpolate(num, energy, kdata, omega);
+  double pref_;                             // V1/(4 pi).
+  double inv_ec1_;                          // 1/(eps_c - 1).
+  double c3_;                               // 4 pi^2 V1/(3 L^3), radiative damping coefficient.
 
-  return IRE*(n_val*n_val - k_val*k_val) + IIM*2.0*n_val*k_val;
+  // Stores the shape coefficients and derives the constants of the formula.
+  void init(
+    const double shape[4] );                // Shape coefficients beta, eps_c, a2, a4.
+};
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Shape coefficients beta, eps_c, a2, a4 of a prism.
+----------------------------------------------------------------------------------------------------------------------*/
+template <class T>
+void shapeCoef(
+  const T &L,                               // Edge length in nm.
+  const T &H,                               // Thickness in nm.
+  const T &R,                               // Triangle base corner radius in nm.
+  T shape[4])                               // Output: shape coefficients.
+{
+  for (int k = 0; k < 4; ++k) {
+    const ShapeFit &f = shape_fit[k];
+    shape[k] = f.a1*pow(L/H, f.p1) + f.a2*pow(L/R, f.p2) + f.a3*pow(H/R, f.p3) + f.a0;
+  }
 }
 
 
 /*----------------------------------------------------------------------------------------------------------------------
-  Size-dependent dielectric function of silver.
+  Constants of the polarizability formula from the geometry and the shape coefficients.
 ----------------------------------------------------------------------------------------------------------------------*/
-std::complex<double> epsAgSD(
+template <class T>
+PolarizCoefT<T> polarizCoef(
+  const T &L,                               // Edge length in nm.
+  const T &H,                               // Thickness in nm.
+  const T shape[4],                         // Shape coefficients beta, eps_c, a2, a4.
+  const T &eps_h)                           // Dielectric permittivity of host media.
+{
+  T V0 = 0.25*sqrt(3.0)*L*L*H;
+  T V1 = V0*shape[0];
+
+  PolarizCoefT<T> c;
+  c.sL = sqrt(eps_h)*L;
+  c.eps_h = eps_h;
+  c.pref = V1/(4.0*M_PI);
+  c.inv_ec1 = 1.0/(shape[1] - 1.0);
+  c.a2 = shape[2];
+  c.a4 = shape[3];
+  c.c3 = 4.0*M_PI*M_PI*V1/(3.0*L*L*L);
+  return c;
+}
+
+
+PrismModel::PrismModel(
+  const double &L,                          // Edge length in nm.
+  const double &H,                          // Thickness in nm.
+  const double &R )                         // Triangle base corner radius in nm.
+  : L_(L), H_(H), R_(R)
+{
+  double shape[4];
+  shapeCoef(L, H, R, shape);
+  init(shape);
+}
+
+
+PrismModel::PrismModel(
+  const double &L,                          // Edge length in nm.
+  const double &H,                          // Thickness in nm.
+  const double &R,                          // Triangle base corner radius in nm.
+  const double shape[4] )                   // Shape coefficients beta, eps_c, a2, a4.
+  : L_(L), H_(H), R_(R)
+{
+  init(shape);
+}
+
+
+void PrismModel::init(
+  const double shape[4] )                   // Shape coefficients beta, eps_c, a2, a4.
+{
+  beta_ = shape[0];
+  eps_c_ = shape[1];
+  a2_ = shape[2];
+  a4_ = shape[3];
+
+  V0_ = 0.25*std::sqrt(3.0)*L_*L_*H_;
+  V1_ = V0_*beta_;
+
+  const PolarizCoef c = polarizCoef(L_, H_, shape, 1.0);
+  pref_ = c.pref;
+  inv_ec1_ = c.inv_ec1;
+  c3_ = c.c3;
+}
+
+
+inline PolarizCoef PrismModel::coef(
+  const double &eps_h ) const               // Dielectric permittivity of host media.
+{
+  PolarizCoef c;
+  c.sL = std::sqrt(eps_h)*L_;
+  c.eps_h = eps_h;
+  c.pref = pref_;
+  c.inv_ec1 = inv_ec1_;
+  c.a2 = a2_;
+  c.a4 = a4_;
+  c.c3 = c3_;
+  return c;
+}
+
+
+inline std::complex<double> PrismModel::polariz(
   const double &lambda,                     // Wavelength in nm.
-  const double &D)                          // Size parameter in nm.
+  const std::complex<double> &eps_m,        // Dielectric permittivity of material.
+  const double &eps_h ) const               // Dielectric permittivity of host media.
 {
-  const std::complex<double> IRE(1.0, 0.0);
-  const std::complex<double> IIM(0.0, 1.0);
+  double re, im;
+  polarizLane(coef(eps_h), lambda, std::real(eps_m), std::imag(eps_m), re, im);
+  return std::complex<double>(re, im);
+}
 
-  const double vF = 1.39e8;         // cm/s (Fermi velocity).
-  const double lam_inf = 5.2e-6;    // cm (mean electron free path).
-  const double omega_p = 9.1;       // eV (plasma angular frequency).
-  const double A = 2.5;             // empirical constant.
 
-  const double h_bar = 6.582e-16;
-  const double gam_inf = h_bar*vF/lam_inf;
-  const double gam_r = gam_inf + A*h_bar*vF*1.0e7*(2.0/D);
+inline double PrismModel::scatCS(
+  const double &lambda,                     // Wavelength in nm.
+  const std::complex<double> &eps_m,        // Dielectric permittivity of material.
+  const double &eps_h ) const               // Dielectric permittivity of host media.
+{
+  std::complex<double> polariz = this->polariz( lambda, eps_m, eps_h );
+  double k = 2.0*M_PI*std::sqrt(eps_h)/lambda;
+  return 8.0*M_PI*std::pow(k, 4)*std::norm(polariz)*1.0e-14/3.0;
+}
 
-  double omega = 1239.8/lambda;
 
-  return epsAg(lambda)
-    + omega_p*omega_p*( IRE/(IRE*omega*omega + IIM*omega*gam_inf) - IRE/(IRE*omega*omega + IIM*omega*gam_r) );
+inline double PrismModel::extCS(
+  const double &lambda,                     // Wavelength in nm.
+  const std::complex<double> &eps_m,        // Dielectric permittivity of material.
+  const double &eps_h ) const               // Dielectric permittivity of host media.
+{
+  std::complex<double> polariz = this->polariz( lambda, eps_m, eps_h );
+  double k = 2.0*M_PI*std::sqrt(eps_h)/lambda;
+  return 4.0*M_PI*k*std::imag(polariz)*1.0e-14;
+}
+
+
+inline void PrismModel::crossSections(
+  const double &lambda,                     // Wavelength in nm.
+  const std::complex<double> &eps_m,        // Dielectric permittivity of material.
+  const double &eps_h,                      // Dielectric permittivity of host media.
+  std::complex<double> &alpha,              // Output: polarizability in nm^3.
+  double &c_sca,                            // Output: scattering cross section in cm^2.
+  double &c_ext,                            // Output: extinction cross section in cm^2.
+  double &c_abs ) const                     // Output: absorption cross section in cm^2.
+{
+  alpha = polariz( lambda, eps_m, eps_h );
+  double k = 2.0*M_PI*std::sqrt(eps_h)/lambda;
+  c_sca = 8.0*M_PI*std::pow(k, 4)*std::norm(alpha)*1.0e-14/3.0;
+  c_ext = 4.0*M_PI*k*std::imag(alpha)*1.0e-14;
+  c_abs = c_ext - c_sca;
+}
+
+
+void PrismModel::spectrum(
+  const int &n,                             // Number of wavelength points.
+  const double lambda[],                    // Wavelengths in nm.
+  const std::complex<double> eps_m[],       // Dielectric permittivity of material at each wavelength.
+  const double &eps_h,                      // Dielectric permittivity of host media.
+  std::complex<double> alpha[],             // Output: polarizability in nm^3.
+  double c_sca[],                           // Output: scattering cross section in cm^2.
+  double c_ext[],                           // Output: extinction cross section in cm^2.
+  double c_abs[] ) const                    // Output: absorption cross section in cm^2.
+{
+  for (int i = 0; i < n; ++i) {
+    std::complex<double> a;
+    double sca, ext, abs;
+    crossSections(lambda[i], eps_m[i], eps_h, a, sca, ext, abs);
+    if (alpha) alpha[i] = a;
+    if (c_sca) c_sca[i] = sca;
+    if (c_ext) c_ext[i] = ext;
+    if (c_abs) c_abs[i] = abs;
+  }
 }
 
 
 /*----------------------------------------------------------------------------------------------------------------------
-  Dielectric function of gold from [R. L. Olmon, B. Slovick, T. W. Johnson, D. Shelton, S.-H. Oh,
-  G. D. Boreman, and M. B. Raschke. Phys. Rev. B, 86, 235147 (2012).]
+  Dipole polarizability in nm^3. The same as PrismModel::polariz(), for any scalar type.
 ----------------------------------------------------------------------------------------------------------------------*/
-std::complex<double> epsAu(
-  const double &lambda)                     // Wavelength in nm.
+template <class T>
+typename ModelNumber<T>::complex dipPolariz(
+  const T &lambda,                          // Wavelength in nm.
+  const typename ModelNumber<T>::complex &eps_m,  // Dielectric permittivity of material.
+  const T &eps_h,                           // Dielectric permittivity of host media.
+  const T &L,                               // Edge length in nm.
+  const T &H,                               // Thickness in nm.
+  const T &R )                              // Triangle base corner radius in nm.
 {
-  const std::complex<double> IRE(1.0, 0.0);
-  const std::complex<double> IIM(0.0, 1.0);
+  T shape[4], re, im;
+  shapeCoef(L, H, R, shape);
+  polarizLane(polarizCoef(L, H, shape, eps_h), lambda, real(eps_m), imag(eps_m), re, im);
+  return typename ModelNumber<T>::complex(re, im);
+}
 
-  const int num = 448;
-  const double energy[] = { 0.0497329, 0.0516601, 0.0535569, 0.0554739, 0.0574001, 0.0592942, 0.0612268, 0.0631284,
-    0.0650494, 0.0669461, 0.0688801, 0.0707672, 0.0726754, 0.0745994, 0.0765334, 0.0784214, 0.0803527, 0.0822722,
-    0.0841712, 0.0861001, 0.0879944, 0.0899088, 0.0918401, 0.0937144, 0.0956668, 0.0975485, 0.0995058, 0.101377,
-    0.10332, 0.10525, 0.10716, 0.109045, 0.110997, 0.112815, 0.1148, 0.116636, 0.118645, 0.12049, 0.122393, 0.124345,
-    0.126257, 0.128176, 0.130085, 0.131996, 0.133907, 0.135828, 0.13773, 0.139653, 0.141567, 0.143467, 0.145385,
-    0.147302, 0.149217, 0.151126, 0.153048, 0.154961, 0.156863, 0.158771, 0.160685, 0.162602, 0.164523, 0.166422,
-    0.168342, 0.170261, 0.172176, 0.174086, 0.175989, 0.177908, 0.179818, 0.181742, 0.183653, 0.18555, 0.187486,
-    0.189376, 0.191304, 0.193212, 0.195128, 0.197051, 0.198948, 0.200849, 0.202787, 0.204696, 0.206606, 0.208517,
-    0.210428, 0.212338, 0.214246, 0.216151, 0.21809, 0.219986, 0.221915, 0.223839, 0.225713, 0.227661, 0.229558,
-    0.231487, 0.233404, 0.235309, 0.237199, 0.239121, 0.241027, 0.242963, 0.244883, 0.246784, 0.248665, 0.250625,
-    0.252514, 0.254431, 0.256325, 0.258247, 0.260143, 0.262068, 0.263965, 0.265889, 0.267842, 0.269707, 0.271657,
-    0.273575, 0.275459, 0.27737, 0.279307, 0.281207, 0.283134, 0.285021, 0.286934, 0.288873, 0.29077, 0.292692,
-    0.294569, 0.296542, 0.298398, 0.300349, 0.302253, 0.304181, 0.306058, 0.307959, 0.309883, 0.311831, 0.313725,
-    0.315642, 0.317582, 0.319465, 0.321369, 0.323296, 0.325247, 0.327135, 0.329045, 0.330978, 0.332843, 0.334731,
-    0.336639, 0.33857, 0.340522, 0.342403, 0.344305, 0.346228, 0.348172, 0.35004, 0.352028, 0.353937, 0.355765,
-    0.357715, 0.359687, 0.361575, 0.363483, 0.365412, 0.367252, 0.36922, 0.371099, 0.372997, 0.374914, 0.376852,
-    0.378809, 0.38067, 0.382549, 0.384566, 0.386364, 0.3883, 0.390256, 0.392107, 0.394101, 0.395989, 0.397895, 0.39982,
-    0.401763, 0.403594, 0.405575, 0.407441, 0.409324, 0.411224, 0.413143, 0.415079, 0.417034, 0.419007, 0.420856,
-    0.422721, 0.424749, 0.426649, 0.428566, 0.430351, 0.432302, 0.43427, 0.436103, 0.438107, 0.439972, 0.441854,
-    0.443752, 0.445666, 0.447596, 0.449544, 0.451508, 0.453324, 0.455322, 0.457169, 0.459031, 0.461079, 0.462973,
-    0.464883, 0.466808, 0.468749, 0.470528, 0.472501, 0.47449, 0.476313, 0.47815, 0.480187, 0.482054, 0.483935,
-    0.485831, 0.487743, 0.489669, 0.491611, 0.493568, 0.49554, 0.497329, 0.499332, 0.501149, 0.503183, 0.505027,
-    0.506885, 0.508757, 0.510854, 0.512755, 0.514671, 0.518329, 0.520286, 0.522259, 0.524246, 0.526025, 0.528042,
-    0.529847, 0.533724, 0.535569, 0.537426, 0.539531, 0.543314, 0.545225, 0.54715, 0.549088, 0.55276, 0.554739,
-    0.556732, 0.558487, 0.562287, 0.564334, 0.566138, 0.570042, 0.571883, 0.575867, 0.577745, 0.579636, 0.583455,
-    0.585383, 0.589278, 0.590964, 0.594934, 0.596939, 0.600699, 0.60245, 0.60628, 0.608362, 0.612268, 0.614087,
-    0.617759, 0.619921, 0.623036, 0.626183, 0.629361, 0.632572, 0.635816, 0.639094, 0.642405, 0.645751, 0.649132,
-    0.652548, 0.656001, 0.65949, 0.663017, 0.666582, 0.670185, 0.673827, 0.677509, 0.681232, 0.684995, 0.688801,
-    0.692649, 0.69654, 0.700476, 0.704456, 0.708481, 0.712553, 0.716672, 0.720838, 0.725054, 0.729319, 0.733634,
-    0.738001, 0.74242, 0.746893, 0.751419, 0.756001, 0.760639, 0.765334, 0.770088, 0.774901, 0.779775, 0.78471,
-    0.789708, 0.79477, 0.799898, 0.805092, 0.810354, 0.815685, 0.821087, 0.826561, 0.832109, 0.837731, 0.84343,
-    0.849207, 0.855063, 0.861001, 0.867022, 0.918401, 0.925255, 0.932212, 0.939274, 0.946444, 0.953724, 0.961118,
-    0.968626, 0.976253, 0.984001, 0.991873, 0.999872, 1.008, 1.01626, 1.02466, 1.0332, 1.04188, 1.05071, 1.05969,
-    1.06883, 1.07812, 1.08758, 1.09721, 1.107, 1.11697, 1.12713, 1.13747, 1.148, 1.15873, 1.16966, 1.1808, 1.19216,
-    1.20373, 1.21553, 1.22757, 1.23984, 1.25237, 1.26514, 1.27819, 1.2915, 1.3051, 1.31898, 1.33316, 1.34765, 1.36246,
-    1.3776, 1.39308, 1.40891, 1.42511, 1.44168, 1.45864, 1.476, 1.49379, 1.512, 1.53067, 1.5498, 1.56942, 1.58954,
-    1.61018, 1.63137, 1.65312, 1.67546, 1.69841, 1.722, 1.74626, 1.7712, 1.79687, 1.8233, 1.85051, 1.87855, 1.90745,
-    1.93725, 1.968, 1.99974, 2.03253, 2.0664, 2.10143, 2.13766, 2.17516, 2.214, 2.25426, 2.296, 2.33932, 2.38431,
-    2.43106, 2.47968, 2.53029, 2.583, 2.63796, 2.69531, 2.7552, 2.81782, 2.88335, 2.952, 3.024, 3.0996, 3.17908,
-    3.26274, 3.35092, 3.444, 3.54241, 3.64659, 3.7571, 3.87451, 3.99949, 4.13281 };
-
-  const double ndata[]  = { 42.79, 40.92, 39.16, 37.49, 35.91, 34.41, 33, 31.66, 30.39, 29.19, 28.05, 26.97, 25.94,
-    24.97, 24.04, 23.17, 22.33, 21.54, 20.78, 20.06, 19.38, 18.72, 18.1, 17.51, 16.94, 16.4, 15.88, 15.38, 14.91, 14.46,
-    14.02, 13.61, 13.21, 12.83, 12.46, 12.11, 11.77, 11.45, 11.14, 10.84, 10.55, 10.27, 10.01, 9.749, 9.502, 9.263,
-    9.034, 8.812, 8.598, 8.392, 8.193, 8, 7.814, 7.634, 7.461, 7.293, 7.13, 6.973, 6.82, 6.673, 6.53, 6.392, 6.258,
-    6.127, 6.001, 5.879, 5.76, 5.645, 5.533, 5.424, 5.319, 5.216, 5.117, 5.02, 4.926, 4.834, 4.745, 4.658, 4.574, 4.492,
-    4.412, 4.334, 4.258, 4.184, 4.112, 4.042, 3.973, 3.906, 3.841, 3.778, 3.716, 3.655, 3.596, 3.539, 3.482, 3.427,
-    3.374, 3.321, 3.27, 3.22, 3.171, 3.123, 3.077, 3.031, 2.986, 2.942, 2.899, 2.858, 2.817, 2.776, 2.737, 2.699, 2.661,
-    2.624, 2.588, 2.553, 2.518, 2.484, 2.451, 2.418, 2.386, 2.355, 2.324, 2.294, 2.264, 2.235, 2.207, 2.179, 2.152,
-    2.125, 2.098, 2.072, 2.047, 2.022, 1.998, 1.974, 1.95, 1.927, 1.904, 1.881, 1.859, 1.838, 1.817, 1.796, 1.775,
-    1.755, 1.735, 1.716, 1.697, 1.678, 1.659, 1.641, 1.623, 1.605, 1.588, 1.571, 1.554, 1.538, 1.521, 1.505, 1.49,
-    1.474, 1.459, 1.444, 1.429, 1.414, 1.4, 1.386, 1.372, 1.358, 1.345, 1.331, 1.318, 1.305, 1.293, 1.28, 1.268, 1.256,
-    1.244, 1.232, 1.22, 1.209, 1.197, 1.186, 1.175, 1.164, 1.153, 1.143, 1.132, 1.122, 1.112, 1.102, 1.092, 1.082,
-    1.073, 1.063, 1.054, 1.045, 1.036, 1.027, 1.018, 1.009, 1, 0.9919, 0.9835, 0.9752, 0.967, 0.9589, 0.9509, 0.943,
-    0.9352, 0.9275, 0.9199, 0.9123, 0.9049, 0.8976, 0.8904, 0.8832, 0.8761, 0.8692, 0.8623, 0.8554, 0.8487, 0.8421,
-    0.8355, 0.829, 0.8226, 0.8162, 0.8099, 0.8037, 0.7976, 0.7916, 0.7856, 0.7797, 0.7738, 0.768, 0.7623, 0.7566,
-    0.7511, 0.7455, 0.7401, 0.7347, 0.7293, 0.724, 0.7136, 0.7085, 0.7034, 0.6984, 0.6935, 0.6886, 0.6837, 0.6742,
-    0.6695, 0.6649, 0.6603, 0.6512, 0.6468, 0.6423, 0.638, 0.6294, 0.6252, 0.621, 0.6168, 0.6087, 0.6047, 0.6007,
-    0.5929, 0.589, 0.5814, 0.5776, 0.5739, 0.5666, 0.563, 0.5559, 0.5524, 0.5455, 0.5421, 0.5354, 0.5321, 0.5256,
-    0.5224, 0.516, 0.5129, 0.5068, 0.5031, 0.4989, 0.4942, 0.4896, 0.4851, 0.4805, 0.476, 0.4715, 0.4671, 0.4627,
-    0.4583, 0.454, 0.4497, 0.4454, 0.4412, 0.4369, 0.4328, 0.4286, 0.4245, 0.4204, 0.4163, 0.4123, 0.4082, 0.4042,
-    0.4003, 0.3963, 0.3924, 0.3885, 0.3847, 0.3808, 0.377, 0.3732, 0.3695, 0.3657, 0.362, 0.3583, 0.3546, 0.351, 0.3474,
-    0.3437, 0.3402, 0.3366, 0.3331, 0.3295, 0.326, 0.3226, 0.3191, 0.3157, 0.3123, 0.3089, 0.3055, 0.3021, 0.2988,
-    0.2955, 0.2922, 0.2889, 0.2857, 0.2824, 0.2551, 0.252, 0.249, 0.246, 0.243, 0.24, 0.2371, 0.2342, 0.2313, 0.2281,
-    0.225, 0.2218, 0.2187, 0.2157, 0.2126, 0.2096, 0.2066, 0.2036, 0.2007, 0.1978, 0.1949, 0.1921, 0.1893, 0.1865,
-    0.1837, 0.181, 0.1783, 0.1757, 0.1731, 0.1705, 0.168, 0.1655, 0.163, 0.1606, 0.1582, 0.1559, 0.1536, 0.1514, 0.1493,
-    0.1471, 0.1451, 0.1431, 0.1412, 0.1393, 0.1375, 0.1358, 0.1342, 0.1326, 0.1312, 0.1298, 0.1286, 0.1275, 0.1265,
-    0.1256, 0.1249, 0.1244, 0.124, 0.1239, 0.1239, 0.1242, 0.1248, 0.1257, 0.1268, 0.1284, 0.1304, 0.1328, 0.1358,
-    0.1394, 0.1436, 0.1487, 0.1546, 0.1616, 0.1698, 0.1794, 0.1908, 0.2041, 0.2199, 0.2388, 0.2617, 0.2899, 0.3256,
-    0.3724, 0.4363, 0.5263, 0.6527, 0.8197, 1.011, 1.193, 1.333, 1.422, 1.472, 1.505, 1.537, 1.567, 1.585, 1.588,
-    1.585, 1.588, 1.606, 1.637, 1.671, 1.695, 1.701, 1.685, 1.649, 1.596 };
-
-  const double kdata[]  = { 137.5, 133.9, 130.4, 127.1, 124, 121, 118.2, 115.5, 112.9, 110.4, 108.1, 105.8, 103.6,
-    101.5, 99.47, 97.52, 95.64, 93.83, 92.08, 90.39, 88.76, 87.18, 85.66, 84.18, 82.76, 81.37, 80.03, 78.73, 77.47,
-    76.25, 75.07, 73.91, 72.8, 71.71, 70.65, 69.63, 68.63, 67.65, 66.71, 65.78, 64.89, 64.01, 63.16, 62.33, 61.52,
-    60.73, 59.96, 59.2, 58.47, 57.75, 57.05, 56.37, 55.7, 55.04, 54.4, 53.78, 53.17, 52.57, 51.98, 51.41, 50.85, 50.3,
-    49.76, 49.24, 48.72, 48.21, 47.72, 47.23, 46.76, 46.29, 45.83, 45.38, 44.94, 44.51, 44.08, 43.67, 43.26, 42.85,
-    42.46, 42.07, 41.69, 41.32, 40.95, 40.59, 40.23, 39.88, 39.54, 39.2, 38.87, 38.54, 38.22, 37.9, 37.59, 37.29, 36.98,
-    36.69, 36.4, 36.11, 35.82, 35.55, 35.27, 35, 34.73, 34.47, 34.21, 33.96, 33.71, 33.46, 33.21, 32.97, 32.74, 32.5,
-    32.27, 32.04, 31.82, 31.6, 31.38, 31.16, 30.95, 30.74, 30.53, 30.33, 30.13, 29.93, 29.73, 29.54, 29.34, 29.15,
-    28.97, 28.78, 28.6, 28.42, 28.24, 28.07, 27.89, 27.72, 27.55, 27.38, 27.22, 27.06, 26.89, 26.73, 26.58, 26.42,
-    26.27, 26.11, 25.96, 25.81, 25.67, 25.52, 25.38, 25.23, 25.09, 24.95, 24.81, 24.68, 24.54, 24.41, 24.28, 24.14,
-    24.01, 23.89, 23.76, 23.63, 23.51, 23.39, 23.26, 23.14, 23.02, 22.91, 22.79, 22.67, 22.56, 22.45, 22.33, 22.22,
-    22.11, 22, 21.89, 21.79, 21.68, 21.57, 21.47, 21.37, 21.26, 21.16, 21.06, 20.96, 20.86, 20.77, 20.67, 20.57, 20.48,
-    20.38, 20.29, 20.2, 20.11, 20.02, 19.93, 19.84, 19.75, 19.66, 19.57, 19.49, 19.4, 19.32, 19.23, 19.15, 19.06, 18.98,
-    18.9, 18.82, 18.74, 18.66, 18.58, 18.5, 18.43, 18.35, 18.27, 18.2, 18.12, 18.05, 17.97, 17.9, 17.83, 17.75, 17.68,
-    17.61, 17.54, 17.47, 17.4, 17.33, 17.26, 17.2, 17.13, 17.06, 17, 16.93, 16.86, 16.8, 16.73, 16.67, 16.61, 16.54,
-    16.42, 16.36, 16.3, 16.24, 16.17, 16.11, 16.06, 15.94, 15.88, 15.82, 15.76, 15.65, 15.59, 15.54, 15.48, 15.37,
-    15.32, 15.26, 15.21, 15.1, 15.05, 15, 14.89, 14.84, 14.74, 14.69, 14.64, 14.54, 14.49, 14.39, 14.35, 14.25, 14.2,
-    14.11, 14.06, 13.97, 13.93, 13.84, 13.79, 13.7, 13.65, 13.59, 13.52, 13.46, 13.39, 13.32, 13.25, 13.19, 13.12,
-    13.05, 12.99, 12.92, 12.85, 12.78, 12.72, 12.65, 12.58, 12.52, 12.45, 12.38, 12.31, 12.25, 12.18, 12.11, 12.04,
-    11.98, 11.91, 11.84, 11.77, 11.71, 11.64, 11.57, 11.5, 11.44, 11.37, 11.3, 11.23, 11.16, 11.1, 11.03, 10.96, 10.89,
-    10.82, 10.76, 10.69, 10.62, 10.55, 10.48, 10.41, 10.35, 10.28, 10.21, 10.14, 10.07, 10, 9.934, 9.865, 9.796, 9.214,
-    9.145, 9.075, 9.005, 8.935, 8.865, 8.795, 8.725, 8.655, 8.581, 8.506, 8.432, 8.358, 8.283, 8.208, 8.134, 8.059,
-    7.984, 7.909, 7.834, 7.759, 7.683, 7.608, 7.532, 7.456, 7.38, 7.304, 7.228, 7.152, 7.075, 6.999, 6.922, 6.845,
-    6.768, 6.69, 6.613, 6.535, 6.457, 6.379, 6.301, 6.222, 6.143, 6.064, 5.985, 5.905, 5.825, 5.745, 5.664, 5.583,
-    5.501, 5.42, 5.338, 5.255, 5.172, 5.088, 5.004, 4.92, 4.834, 4.749, 4.662, 4.575, 4.487, 4.398, 4.308, 4.217,
-    4.126, 4.033, 3.938, 3.843, 3.746, 3.647, 3.547, 3.444, 3.34, 3.232, 3.122, 3.009, 2.891, 2.769, 2.641, 2.507,
-    2.364, 2.213, 2.058, 1.908, 1.787, 1.72, 1.716, 1.758, 1.812, 1.855, 1.877, 1.887, 1.898, 1.911, 1.915, 1.904,
-    1.877, 1.846, 1.825, 1.821, 1.835, 1.858, 1.881, 1.895, 1.888 };
-
-  double omega = 1239.8/lambda;
-
-  if ((omega < energy[0]) && (omega > energy[num - 1])) {
-    std::cout << "Argument of dielectric function of gold is out of range" << std::endl;
-    exit(0);
-  }
 
-  double n_val = interpolate(num, energy, ndata, omega);
-  double k_val = interpolate(num, energy, kdata, omega);
+/*----------------------------------------------------------------------------------------------------------------------
+  Scattering cross section in cm^2.
+----------------------------------------------------------------------------------------------------------------------*/
+template <class T>
+typename ModelNumber<T>::type scatCSdip(
+  const T &lambda,                          // Wavelength in nm.
+  const typename ModelNumber<T>::complex &eps_m,  // Dielectric permittivity of material.
+  const T &eps_h,                           // Dielectric permittivity of host media.
+  const T &L,                               // Edge length in nm.
+  const T &H,                               // Thickness in nm.
+  const T &R )                              // Triangle base corner radius in nm.
+{
+  typename ModelNumber<T>::complex polariz = dipPolariz(lambda, eps_m, eps_h, L, H, R);
+  T k = 2.0*M_PI*sqrt(eps_h)/lambda;
+  return 8.0*M_PI*pow(k, 4)*norm(polariz)*1.0e-14/3.0;
+}
+
 
-  return IRE*(n_val*n_val - k_val*k_val) + IIM*2.0*n_val*k_val;
+/*----------------------------------------------------------------------------------------------------------------------
+  Extinction cross section in cm^2.
+----------------------------------------------------------------------------------------------------------------------*/
+template <class T>
+typename ModelNumber<T>::type extCSdip(
+  const T &lambda,                          // Wavelength in nm.
+  const typename ModelNumber<T>::complex &eps_m,  // Dielectric permittivity of material.
+  const T &eps_h,                           // Dielectric permittivity of host media.
+  const T &L,                               // Edge length in nm.
+  const T &H,                               // Thickness in nm.
+  const T &R )                              // Triangle base corner radius in nm.
+{
+  typename ModelNumber<T>::complex polariz = dipPolariz(lambda, eps_m, eps_h, L, H, R);
+  T k = 2.0*M_PI*sqrt(eps_h)/lambda;
+  return 4.0*M_PI*k*imag(polariz)*1.0e-14;
 }
 
 
 /*----------------------------------------------------------------------------------------------------------------------
-  Size-dependent dielectric function of gold.
+  The same for double arguments. Template deduction needs all arguments of one type; these take e.g. an int size
+  or a float wavelength through the usual conversions.
 ----------------------------------------------------------------------------------------------------------------------*/
-std::complex<double> epsAuSD(
+std::complex<double> dipPolariz(
   const double &lambda,                     // Wavelength in nm.
-  const double &D)                          // Size parameter in nm.
+  const std::complex<double> &eps_m,        // Dielectric permittivity of material.
+  const double &eps_h,                      // Dielectric permittivity of host media.
+  const double &L,                          // Edge length in nm.
+  const double &H,                          // Thickness in nm.
+  const double &R )                         // Triangle base corner radius in nm.
 {
-  const std::complex<double> IRE(1.0, 0.0);
-  const std::complex<double> IIM(0.0, 1.0);
+  return dipPolariz<double>(lambda, eps_m, eps_h, L, H, R);
+}
 
-  const double vF = 1.38e8;         // cm/s (Fermi velocity).
-  const double lam_inf = 1.28e-6;   // cm (mean electron free path).
-  const double omega_p = 9.0;       // eV (plasma angular frequency).
-  const double A = 2.0;             // empirical constant.
 
-  const double h_bar = 6.582e-16;
-  const double gam_inf = h_bar*vF/lam_inf;
-  const double gam_r = gam_inf + A*h_bar*vF*1.0e7*(2.0/D);
+double scatCSdip(
+  const double &lambda,                     // Wavelength in nm.
+  const std::complex<double> &eps_m,        // Dielectric permittivity of material.
+  const double &eps_h,                      // Dielectric permittivity of host media.
+  const double &L,                          // Edge length in nm.
+  const double &H,                          // Thickness in nm.
+  const double &R )                         // Triangle base corner radius in nm.
+{
+  return scatCSdip<double>(lambda, eps_m, eps_h, L, H, R);
+}
 
-  double omega = 1239.8/lambda;
 
-  return epsAu(lambda)
-    + omega_p*omega_p*( IRE/(IRE*omega*omega + IIM*omega*gam_inf) - IRE/(IRE*omega*omega + IIM*omega*gam_r) );
+double extCSdip(
+  const double &lambda,                     // Wavelength in nm.
+  const std::complex<double> &eps_m,        // Dielectric permittivity of material.
+  const double &eps_h,                      // Dielectric permittivity of host media.
+  const double &L,                          // Edge length in nm.
+  const double &H,                          // Thickness in nm.
+  const double &R )                         // Triangle base corner radius in nm.
+{
+  return extCSdip<double>(lambda, eps_m, eps_h, L, H, R);
 }
 
 
+/***********************************************************************************************************************
+  Batch kernels over wavelength and particle arrays.
+
+  The kernels are written once for a GCC vector of W doubles and instantiated inside functions compiled for
+  SSE2 (W = 2), AVX2 (W = 4) and AVX-512 (W = 8). The widest kernel supported by the CPU is chosen via CPUID
+  on first use, so the same binary runs on any x86-64 machine.
+***********************************************************************************************************************/
+
+typedef void (*PolarizKernel)(int n, const double *lambda, const double *eps_re, const double *eps_im,
+                              const PolarizCoef &c, double *alpha_re, double *alpha_im);
+
+
 /*----------------------------------------------------------------------------------------------------------------------
-  Diameter of a sphere of the same volume as the prism with equilateral triangle base.
+  Scalar kernel.
 ----------------------------------------------------------------------------------------------------------------------*/
-double diameter(
-  const double &L,                          // Edge length in nm.
-  const double &H)                          // Thickness in nm.
+static void polarizKernelScalar(
+  int n, const double *lambda, const double *eps_re, const double *eps_im,
+  const PolarizCoef &c, double *alpha_re, double *alpha_im)
 {
-  return 2.0*pow( (3.0*sqrt(3.0)*L*L*H/(16.0*M_PI)), 1.0/3.0 );
+  for (int i = 0; i < n; ++i)
+    polarizLane(c, lambda[i], eps_re[i], eps_im[i], alpha_re[i], alpha_im[i]);
 }
 
 
-/***********************************************************************************************************************
-  The example program.
-***********************************************************************************************************************/
+#if defined(__GNUC__)
 
-int main(int argc, char **argv)
+template <int W> struct SimdLanes
 {
+  typedef double V __attribute__((vector_size(W*sizeof(double))));
+  typedef long long I __attribute__((vector_size(W*sizeof(long long))));
+};
+
+template <> struct SimdLanes<1>
+{
+  typedef double V;
+  typedef long long I;
+};
 
-  // ----- Calculation parameters. -----
-  const double L_size =  50.0;            // Edge length in nm.
-  const double R_size =   2.0;            // Triangle base corner radius in nm.
-  const double H_size =  20.0;            // Thickness in nm.
 
-  const double eps_h = 1.0;               // Dielectric permittivity of host media.
-  const bool is_silver = true;            // Switch to choose material: true - silver, false - gold.
+template <class To, class From>
+static TRIANGLE_INLINE void laneCast(const From &x, To &y)
+{
+  memcpy(&y, &x, sizeof(To));
+}
 
-  const double wl_min =  300.0;           // Minimal value of wavelength range to print results in nm.
-  const double wl_max =  800.0;           // Maximal value of wavelength range to print results in nm.
-  const double wl_step =   2.0;           // Wavelength step to print results in nm.
 
-  // Effective size (diameter) to calculate size-dependent dielectric function.
-  const double D_SD = diameter(L_size, H_size); 
-  std::cout << "Effective size to calculate size-dependent dielectric function = " << D_SD << " nm." << std::endl;
+/*----------------------------------------------------------------------------------------------------------------------
+  Natural logarithm of W lanes, for positive normal arguments. The mantissa is reduced to [sqrt(1/2), sqrt(2))
+  and log(1 + f) = 2 atanh(f/(2 + f)) is summed up to the 23rd power, which gives about 1e-16 relative error.
+  Results are returned through reference arguments: vector return values would change the ABI of the
+  non-AVX instantiations.
+----------------------------------------------------------------------------------------------------------------------*/
+template <int W>
+static TRIANGLE_INLINE void simdLog(
+  const typename SimdLanes<W>::V &x,        // Argument.
+  typename SimdLanes<W>::V &res)            // Output: log(x).
+{
+  typedef typename SimdLanes<W>::V V;
+  typedef typename SimdLanes<W>::I I;
 
-  int wl_n = (int)((wl_max - wl_min)/wl_step) + 1;
-  std::string file_name_re = "analytic_model-polarizability_re.dat";
-  std::string file_name_im = "analytic_model-polarizability_im.dat";
-  std::string file_name_sc = "analytic_model-scattering_cs.dat";
-  std::string file_name_ex = "analytic_model-extinction_cs.dat";
-  std::ofstream fout_re(file_name_re.c_str(), std::ios::out);
-  std::ofstream fout_im(file_name_im.c_str(), std::ios::out);
-  std::ofstream fout_sc(file_name_sc.c_str(), std::ios::out);
-  std::ofstream fout_ex(file_name_ex.c_str(), std::ios::out);
-  for (int i = 0; i < wl_n; ++i) {
-    double wl = wl_min + i*wl_step;
-    std::complex<double> eps_m;
-    if (is_silver) eps_m = epsAgSD(wl, D_SD); else eps_m = epsAuSD(wl, D_SD);
-    std::complex<double> val = dipPolariz(wl, eps_m, eps_h, L_size, H_size, R_size);
-    fout_re << wl << " " << std::real(val) << std::endl;
-    fout_im << wl << " " << std::imag(val) << std::endl;
-    fout_sc << wl << " " << scatCSdip(wl, eps_m, eps_h, L_size, H_size, R_size) << std::endl;
-    fout_ex << wl << " " << extCSdip(wl, eps_m, eps_h, L_size, H_size, R_size) << std::endl;
-  }
-  fout_re.close();
-  fout_im.close();
-  fout_sc.close();
-  fout_ex.close();
+  I bits, e_bits, m_bits;
+  laneCast(x, bits);
+  e_bits = (bits >> 52) | 0x4330000000000000LL;
+  m_bits = (bits & 0x000fffffffffffffLL) | 0x3ff0000000000000LL;
+
+  V e, m;
+  laneCast(e_bits, e);
+  laneCast(m_bits, m);
+  e = e - (4503599627370496.0 + 1023.0);    // Biased exponent read as 2^52 + k.
+
+  V m_half = 0.5*m;
+  V e_next = e + 1.0;
+  auto above = m > M_SQRT2;
+  m = above ? m_half : m;
+  e = above ? e_next : e;
+
+  V f = m - 1.0;
+  V t = f/(2.0 + f);
+  V z = t*t;
+  V p = z*(1.0/23.0) + 1.0/21.0;
+  p = p*z + 1.0/19.0;
+  p = p*z + 1.0/17.0;
+  p = p*z + 1.0/15.0;
+  p = p*z + 1.0/13.0;
+  p = p*z + 1.0/11.0;
+  p = p*z + 1.0/9.0;
+  p = p*z + 1.0/7.0;
+  p = p*z + 1.0/5.0;
+  p = p*z + 1.0/3.0;
+  p = p*z + 1.0;
+  res = e*M_LN2 + 2.0*t*p;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Exponential of W lanes. y = n ln2 + r with |r| <= ln2/2, exp(r) by its Taylor series to the 13th power and 2^n
+  assembled directly in the exponent bits of two factors, so that large arguments give inf and small ones
+  subnormals or 0 as std::exp does.
+----------------------------------------------------------------------------------------------------------------------*/
+template <int W>
+static TRIANGLE_INLINE void simdExp(
+  const typename SimdLanes<W>::V &y,        // Argument.
+  typename SimdLanes<W>::V &res)            // Output: exp(y).
+{
+  typedef typename SimdLanes<W>::V V;
+  typedef typename SimdLanes<W>::I I;
+
+  const double shift = 6755399441055744.0;  // 1.5*2^52, rounds to integer in the low mantissa bits.
+  V yc = (y > 710.0) ? 710.0 : y;           // Beyond these exp overflows to inf or underflows to 0 anyway;
+  yc = (yc < -746.0) ? -746.0 : yc;         // NaN passes both.
+  V t = yc*M_LOG2E + shift;
+  V n = t - shift;
+  I k;
+  laneCast(t, k);
+  k -= 0x4338000000000000LL;
+  I k1 = k >> 1;                            // 2^n as 2^k1*2^(n - k1), both normal for the whole range.
+  I k2 = k - k1;
+  k1 = (k1 + 1023) << 52;
+  k2 = (k2 + 1023) << 52;
+  V scale1, scale2;
+  laneCast(k1, scale1);
+  laneCast(k2, scale2);
+
+  V r = (yc - n*6.93147180369123816490e-01) - n*1.90821492927058770002e-10;
+  V p = r*(1.0/6227020800.0) + 1.0/479001600.0;
+  p = p*r + 1.0/39916800.0;
+  p = p*r + 1.0/3628800.0;
+  p = p*r + 1.0/362880.0;
+  p = p*r + 1.0/40320.0;
+  p = p*r + 1.0/5040.0;
+  p = p*r + 1.0/720.0;
+  p = p*r + 1.0/120.0;
+  p = p*r + 1.0/24.0;
+  p = p*r + 1.0/6.0;
+  p = p*r + 0.5;
+  p = p*r + 1.0;
+  p = p*r + 1.0;
+  res = (p*scale1)*scale2;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  a*x^p from log(x), the building block of the shape coefficient fits.
+----------------------------------------------------------------------------------------------------------------------*/
+template <int W>
+static TRIANGLE_INLINE void simdPowTerm(
+  const double &a,                          // Factor.
+  const typename SimdLanes<W>::V &log_x,    // Logarithm of base.
+  const double &p,                          // Exponent.
+  typename SimdLanes<W>::V &res)            // Output: a*x^p.
+{
+  simdExp<W>(p*log_x, res);
+  res = a*res;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Constants of the polarizability formula for W particles at once, same fits as in shapeCoef().
+  Only three logarithms are needed; the twelve powers are exponentials of their multiples.
+----------------------------------------------------------------------------------------------------------------------*/
+template <int W>
+static TRIANGLE_INLINE void shapeCoefLanes(
+  const typename SimdLanes<W>::V &L,        // Edge length in nm.
+  const typename SimdLanes<W>::V &H,        // Thickness in nm.
+  const typename SimdLanes<W>::V &R,        // Triangle base corner radius in nm.
+  const double &eps_h,                      // Dielectric permittivity of host media.
+  PolarizCoefT<typename SimdLanes<W>::V> &c)  // Output: constants of the formula.
+{
+  typedef typename SimdLanes<W>::V V;
+
+  V lh, lr, hr;
+  simdLog<W>(L/H, lh);
+  simdLog<W>(L/R, lr);
+  simdLog<W>(H/R, hr);
+
+  V shape[4];
+  for (int k = 0; k < 4; ++k) {
+    const ShapeFit &f = shape_fit[k];
+    V t1, t2, t3;
+    simdPowTerm<W>(f.a1, lh, f.p1, t1);
+    simdPowTerm<W>(f.a2, lr, f.p2, t2);
+    simdPowTerm<W>(f.a3, hr, f.p3, t3);
+    shape[k] = t1 + t2 + t3 + f.a0;
+  }
+  const V &beta = shape[0];
+  const V &eps_c = shape[1];
+  c.a2 = shape[2];
+  c.a4 = shape[3];
+
+  V V1 = 0.25*std::sqrt(3.0)*L*L*H*beta;
+  c.sL = std::sqrt(eps_h)*L;
+  c.eps_h = V() + eps_h;
+  c.pref = V1/(4.0*M_PI);
+  c.inv_ec1 = 1.0/(eps_c - 1.0);
+  c.c3 = 4.0*M_PI*M_PI*V1/(3.0*L*L*L);
+}
+
+
+template <int W>
+static TRIANGLE_INLINE void polarizKernelLanes(
+  int n, const double *lambda, const double *eps_re, const double *eps_im,
+  const PolarizCoef &c, double *alpha_re, double *alpha_im)
+{
+  typedef typename SimdLanes<W>::V V;
+  int i = 0;
+  for (; i + W <= n; i += W) {
+    V wl, er, ei, ar, ai;
+    memcpy(&wl, lambda + i, sizeof(V));
+    memcpy(&er, eps_re + i, sizeof(V));
+    memcpy(&ei, eps_im + i, sizeof(V));
+    polarizLane(c, wl, er, ei, ar, ai);
+    memcpy(alpha_re + i, &ar, sizeof(V));
+    memcpy(alpha_im + i, &ai, sizeof(V));
+  }
+  // The tail stays in this function: a tail call to the scalar kernel leaves the upper halves of the vector
+  // registers dirty, which slows down all the SSE code after it.
+  for (; i < n; ++i)
+    polarizLane(c, lambda[i], eps_re[i], eps_im[i], alpha_re[i], alpha_im[i]);
+}
+
+#endif
+
+
+#if defined(TRIANGLE_X86_DISPATCH)
+
+__attribute__((target("sse2")))
+static void polarizKernelSSE2(
+  int n, const double *lambda, const double *eps_re, const double *eps_im,
+  const PolarizCoef &c, double *alpha_re, double *alpha_im)
+{
+  polarizKernelLanes<2>(n, lambda, eps_re, eps_im, c, alpha_re, alpha_im);
+}
+
+
+__attribute__((target("avx2")))
+static void polarizKernelAVX2(
+  int n, const double *lambda, const double *eps_re, const double *eps_im,
+  const PolarizCoef &c, double *alpha_re, double *alpha_im)
+{
+  polarizKernelLanes<4>(n, lambda, eps_re, eps_im, c, alpha_re, alpha_im);
+}
+
+
+__attribute__((target("avx512f")))
+static void polarizKernelAVX512(
+  int n, const double *lambda, const double *eps_re, const double *eps_im,
+  const PolarizCoef &c, double *alpha_re, double *alpha_im)
+{
+  polarizKernelLanes<8>(n, lambda, eps_re, eps_im, c, alpha_re, alpha_im);
+}
+
+#endif
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Kernels over particles: n geometries at one wavelength, permittivity given per particle (it is size-dependent).
+  Output arrays other than alpha may be NULL.
+----------------------------------------------------------------------------------------------------------------------*/
+struct ParticleBatch
+{
+  int n;                                    // Number of particles.
+  const double *L, *H, *R;                  // Geometry in nm.
+  const double *eps_re, *eps_im;            // Permittivity of material for each particle.
+  double lambda;                            // Wavelength in nm.
+  double eps_h;                             // Dielectric permittivity of host media.
+  double *alpha_re, *alpha_im;              // Output: polarizability in nm^3.
+  double *c_sca, *c_ext, *c_abs;            // Output: cross sections in cm^2.
+};
+
+typedef void (*ParticleKernel)(const ParticleBatch &b);
+
+
+static void particleKernelScalar(
+  const ParticleBatch &b)
+{
+  double k = 2.0*M_PI*std::sqrt(b.eps_h)/b.lambda;
+  for (int i = 0; i < b.n; ++i) {
+    PrismModel prism(b.L[i], b.H[i], b.R[i]);
+    polarizLane(prism.coef(b.eps_h), b.lambda, b.eps_re[i], b.eps_im[i], b.alpha_re[i], b.alpha_im[i]);
+    double sca = 8.0*M_PI*std::pow(k, 4)*(b.alpha_re[i]*b.alpha_re[i] + b.alpha_im[i]*b.alpha_im[i])*1.0e-14/3.0;
+    double ext = 4.0*M_PI*k*b.alpha_im[i]*1.0e-14;
+    if (b.c_sca) b.c_sca[i] = sca;
+    if (b.c_ext) b.c_ext[i] = ext;
+    if (b.c_abs) b.c_abs[i] = ext - sca;
+  }
+}
+
+
+#if defined(__GNUC__)
+
+template <int W>
+static TRIANGLE_INLINE void particleKernelLanes(
+  const ParticleBatch &b)
+{
+  typedef typename SimdLanes<W>::V V;
+  double k = 2.0*M_PI*std::sqrt(b.eps_h)/b.lambda;
+  double f_sca = 8.0*M_PI*std::pow(k, 4)*1.0e-14/3.0;
+  double f_ext = 4.0*M_PI*k*1.0e-14;
+  int i = 0;
+  for (; i + W <= b.n; i += W) {
+    V L, H, R, er, ei, ar, ai;
+    memcpy(&L, b.L + i, sizeof(V));
+    memcpy(&H, b.H + i, sizeof(V));
+    memcpy(&R, b.R + i, sizeof(V));
+    memcpy(&er, b.eps_re + i, sizeof(V));
+    memcpy(&ei, b.eps_im + i, sizeof(V));
+    PolarizCoefT<V> c;
+    shapeCoefLanes<W>(L, H, R, b.eps_h, c);
+    V wl = V() + b.lambda;
+    polarizLane(c, wl, er, ei, ar, ai);
+    memcpy(b.alpha_re + i, &ar, sizeof(V));
+    memcpy(b.alpha_im + i, &ai, sizeof(V));
+    V sca = f_sca*(ar*ar + ai*ai);
+    V ext = f_ext*ai;
+    V abs = ext - sca;
+    if (b.c_sca) memcpy(b.c_sca + i, &sca, sizeof(V));
+    if (b.c_ext) memcpy(b.c_ext + i, &ext, sizeof(V));
+    if (b.c_abs) memcpy(b.c_abs + i, &abs, sizeof(V));
+  }
+
+  ParticleBatch tail = b;
+  tail.n = b.n - i;
+  tail.L += i;  tail.H += i;  tail.R += i;
+  tail.eps_re += i;  tail.eps_im += i;
+  tail.alpha_re += i;  tail.alpha_im += i;
+  if (tail.c_sca) tail.c_sca += i;
+  if (tail.c_ext) tail.c_ext += i;
+  if (tail.c_abs) tail.c_abs += i;
+  particleKernelScalar(tail);
+}
+
+#endif
+
+
+#if defined(TRIANGLE_X86_DISPATCH)
+
+__attribute__((target("sse2")))
+static void particleKernelSSE2(const ParticleBatch &b) { particleKernelLanes<2>(b); }
+
+__attribute__((target("avx2")))
+static void particleKernelAVX2(const ParticleBatch &b) { particleKernelLanes<4>(b); }
+
+__attribute__((target("avx512f")))
+static void particleKernelAVX512(const ParticleBatch &b) { particleKernelLanes<8>(b); }
+
+#endif
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Kernels of the size correction over wavelengths: eps = base - omega_p^2/(omega^2 + i omega gam), where base is
+  the bulk permittivity with its free-electron term omega_p^2/(omega^2 + i omega gam_inf) added back.
+----------------------------------------------------------------------------------------------------------------------*/
+template <class T>
+static TRIANGLE_INLINE void drudeLane(
+  const double &omega_p2,                   // Squared plasma frequency in eV^2.
+  const double &gam,                        // Size-dependent damping in eV.
+  const T &omega,                           // Photon energy in eV.
+  const T &base_re,                         // Real part of base permittivity.
+  const T &base_im,                         // Imaginary part of base permittivity.
+  T &eps_re,                                // Output: real part of permittivity.
+  T &eps_im)                                // Output: imaginary part of permittivity.
+{
+  T d = omega_p2/(omega*omega + gam*gam);
+  eps_re = base_re - d;
+  eps_im = base_im + d*gam/omega;
+}
+
+
+typedef void (*DrudeKernel)(int n, const double *omega, const double *base_re, const double *base_im,
+                            double omega_p2, double gam, double *eps_re, double *eps_im);
+
+
+static void drudeKernelScalar(
+  int n, const double *omega, const double *base_re, const double *base_im,
+  double omega_p2, double gam, double *eps_re, double *eps_im)
+{
+  for (int i = 0; i < n; ++i)
+    drudeLane(omega_p2, gam, omega[i], base_re[i], base_im[i], eps_re[i], eps_im[i]);
+}
+
+
+#if defined(__GNUC__)
+
+template <int W>
+static TRIANGLE_INLINE void drudeKernelLanes(
+  int n, const double *omega, const double *base_re, const double *base_im,
+  double omega_p2, double gam, double *eps_re, double *eps_im)
+{
+  typedef typename SimdLanes<W>::V V;
+  int i = 0;
+  for (; i + W <= n; i += W) {
+    V om, br, bi, er, ei;
+    memcpy(&om, omega + i, sizeof(V));
+    memcpy(&br, base_re + i, sizeof(V));
+    memcpy(&bi, base_im + i, sizeof(V));
+    drudeLane(omega_p2, gam, om, br, bi, er, ei);
+    memcpy(eps_re + i, &er, sizeof(V));
+    memcpy(eps_im + i, &ei, sizeof(V));
+  }
+  for (; i < n; ++i)                        // In this function, as in polarizKernelLanes().
+    drudeLane(omega_p2, gam, omega[i], base_re[i], base_im[i], eps_re[i], eps_im[i]);
+}
+
+#endif
+
+
+#if defined(TRIANGLE_X86_DISPATCH)
+
+__attribute__((target("sse2")))
+static void drudeKernelSSE2(
+  int n, const double *omega, const double *base_re, const double *base_im,
+  double omega_p2, double gam, double *eps_re, double *eps_im)
+{
+  drudeKernelLanes<2>(n, omega, base_re, base_im, omega_p2, gam, eps_re, eps_im);
+}
+
+
+__attribute__((target("avx2")))
+static void drudeKernelAVX2(
+  int n, const double *omega, const double *base_re, const double *base_im,
+  double omega_p2, double gam, double *eps_re, double *eps_im)
+{
+  drudeKernelLanes<4>(n, omega, base_re, base_im, omega_p2, gam, eps_re, eps_im);
+}
+
+
+__attribute__((target("avx512f")))
+static void drudeKernelAVX512(
+  int n, const double *omega, const double *base_re, const double *base_im,
+  double omega_p2, double gam, double *eps_re, double *eps_im)
+{
+  drudeKernelLanes<8>(n, omega, base_re, base_im, omega_p2, gam, eps_re, eps_im);
+}
+
+#endif
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Widest SIMD level supported by the CPU: 0 - scalar, 2 - SSE2, 4 - AVX2, 8 - AVX-512 (doubles per vector).
+----------------------------------------------------------------------------------------------------------------------*/
+static int detectSimdWidth()
+{
+#if defined(TRIANGLE_X86_DISPATCH)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return 8;
+  if (__builtin_cpu_supports("avx2")) return 4;
+  if (__builtin_cpu_supports("sse2")) return 2;
+#endif
+  return 0;
+}
+
+
+int simdWidth()
+{
+  static const int width = detectSimdWidth();
+  return width;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Kernels of a SIMD level, by default the widest one of the CPU; the self-test runs each level in turn.
+----------------------------------------------------------------------------------------------------------------------*/
+static PolarizKernel polarizKernel(
+  const int &width = simdWidth())           // SIMD level, as returned by simdWidth().
+{
+#if defined(TRIANGLE_X86_DISPATCH)
+  switch (width) {
+    case 8: return polarizKernelAVX512;
+    case 4: return polarizKernelAVX2;
+    case 2: return polarizKernelSSE2;
+  }
+#endif
+  return polarizKernelScalar;
+}
+
+
+static ParticleKernel particleKernel(
+  const int &width = simdWidth())           // SIMD level, as returned by simdWidth().
+{
+#if defined(TRIANGLE_X86_DISPATCH)
+  switch (width) {
+    case 8: return particleKernelAVX512;
+    case 4: return particleKernelAVX2;
+    case 2: return particleKernelSSE2;
+  }
+#endif
+  return particleKernelScalar;
+}
+
+
+static DrudeKernel drudeKernel(
+  const int &width = simdWidth())           // SIMD level, as returned by simdWidth().
+{
+#if defined(TRIANGLE_X86_DISPATCH)
+  switch (width) {
+    case 8: return drudeKernelAVX512;
+    case 4: return drudeKernelAVX2;
+    case 2: return drudeKernelSSE2;
+  }
+#endif
+  return drudeKernelScalar;
+}
+
+
+void PrismModel::polarizBatch(
+  const int &n,                             // Number of wavelength points.
+  const double lambda[],                    // Wavelengths in nm.
+  const double eps_re[],                    // Real part of permittivity of material.
+  const double eps_im[],                    // Imaginary part of permittivity of material.
+  const double &eps_h,                      // Dielectric permittivity of host media.
+  double alpha_re[],                        // Output: real part of polarizability in nm^3.
+  double alpha_im[] ) const                 // Output: imaginary part of polarizability in nm^3.
+{
+  static const PolarizKernel kernel = polarizKernel();
+  kernel(n, lambda, eps_re, eps_im, coef(eps_h), alpha_re, alpha_im);
+}
+
+
+void PrismModel::spectrumBatch(
+  const int &n,                             // Number of wavelength points.
+  const double lambda[],                    // Wavelengths in nm.
+  const double eps_re[],                    // Real part of permittivity of material.
+  const double eps_im[],                    // Imaginary part of permittivity of material.
+  const double &eps_h,                      // Dielectric permittivity of host media.
+  double alpha_re[],                        // Output: real part of polarizability in nm^3.
+  double alpha_im[],                        // Output: imaginary part of polarizability in nm^3.
+  double c_sca[],                           // Output: scattering cross section in cm^2.
+  double c_ext[],                           // Output: extinction cross section in cm^2.
+  double c_abs[] ) const                    // Output: absorption cross section in cm^2.
+{
+  polarizBatch(n, lambda, eps_re, eps_im, eps_h, alpha_re, alpha_im);
+  for (int i = 0; i < n; ++i) {
+    double k = 2.0*M_PI*std::sqrt(eps_h)/lambda[i];
+    double sca = 8.0*M_PI*std::pow(k, 4)*(alpha_re[i]*alpha_re[i] + alpha_im[i]*alpha_im[i])*1.0e-14/3.0;
+    double ext = 4.0*M_PI*k*alpha_im[i]*1.0e-14;
+    if (c_sca) c_sca[i] = sca;
+    if (c_ext) c_ext[i] = ext;
+    if (c_abs) c_abs[i] = ext - sca;
+  }
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Polarizability and cross sections of n prisms at one wavelength, the particles being spread over SIMD lanes
+  together with the shape coefficient fits. Arrays are in structure-of-arrays layout; c_sca, c_ext and c_abs
+  may be NULL.
+----------------------------------------------------------------------------------------------------------------------*/
+void particleCrossSections(
+  const int &n,                             // Number of particles.
+  const double L[],                         // Edge lengths in nm.
+  const double H[],                         // Thicknesses in nm.
+  const double R[],                         // Triangle base corner radii in nm.
+  const double &lambda,                     // Wavelength in nm.
+  const double eps_re[],                    // Real part of permittivity of material for each particle.
+  const double eps_im[],                    // Imaginary part of permittivity of material for each particle.
+  const double &eps_h,                      // Dielectric permittivity of host media.
+  double alpha_re[],                        // Output: real part of polarizability in nm^3.
+  double alpha_im[],                        // Output: imaginary part of polarizability in nm^3.
+  double c_sca[],                           // Output: scattering cross section in cm^2.
+  double c_ext[],                           // Output: extinction cross section in cm^2.
+  double c_abs[])                           // Output: absorption cross section in cm^2.
+{
+  static const ParticleKernel kernel = particleKernel();
+  ParticleBatch b;
+  b.n = n;
+  b.L = L;  b.H = H;  b.R = R;
+  b.eps_re = eps_re;  b.eps_im = eps_im;
+  b.lambda = lambda;
+  b.eps_h = eps_h;
+  b.alpha_re = alpha_re;  b.alpha_im = alpha_im;
+  b.c_sca = c_sca;  b.c_ext = c_ext;  b.c_abs = c_abs;
+  kernel(b);
+}
+
+
+/***********************************************************************************************************************
+  Dielectric functions of silver and gold.
+***********************************************************************************************************************/
+
+/*----------------------------------------------------------------------------------------------------------------------
+  First point of the 4-point interpolation stencil for x_val: the interval [x_arr[i], x_arr[i+1]] containing
+  x_val is found by binary search, and the stencil x_arr[i-1..i+2] is shifted inside the table at its ends.
+----------------------------------------------------------------------------------------------------------------------*/
+int interpStencil(
+  const int &n,                             // Size of arrays.
+  const double x_arr[],                     // Array of arguments, increasing.
+  const double &x_val)                      // Argument value to interpolate for.
+{
+  int i = (int)(std::upper_bound(x_arr, x_arr + n, x_val) - x_arr) - 1;
+  if(i < 1) i = 1;
+  if(i > n - 3) i = n - 3;
+  return i;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Number of buckets of the acceleration index of a table: the argument range divided by the smallest table step,
+  limited to 16 buckets per table point.
+----------------------------------------------------------------------------------------------------------------------*/
+constexpr int bucketCount(
+  const int n,                              // Size of arrays.
+  const double x_arr[])                     // Array of arguments, increasing.
+{
+  double step = x_arr[n - 1] - x_arr[0];
+  for (int j = 1; j < n; ++j)
+    if (x_arr[j] - x_arr[j - 1] < step) step = x_arr[j] - x_arr[j - 1];
+
+  int num = (int)((x_arr[n - 1] - x_arr[0])/step) + 1;
+  return (num > 16*n) ? 16*n : num;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Bucket table of the acceleration index: lo[b] is the last table point not greater than the start of bucket b.
+----------------------------------------------------------------------------------------------------------------------*/
+constexpr void fillBuckets(
+  const int n,                              // Size of arrays.
+  const double x_arr[],                     // Array of arguments, increasing.
+  const int num,                            // Number of buckets.
+  int lo[])                                 // Output: num + 1 bucket entries.
+{
+  double inv_w = num/(x_arr[n - 1] - x_arr[0]);
+  int i = -1;
+  for (int b = 0; b <= num; ++b) {
+    double start = x_arr[0] + b/inv_w;
+    while (i < n - 1 && !(x_arr[i + 1] > start)) ++i;
+    lo[b] = i;
+  }
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Interval lookup through the bucket table: the last table point not greater than x_val, -1 below the table.
+----------------------------------------------------------------------------------------------------------------------*/
+inline int bucketInterval(
+  const int &n,                             // Size of arrays.
+  const double x_arr[],                     // Array of arguments, increasing.
+  const int &num,                           // Number of buckets.
+  const double &inv_w,                      // Inverse bucket width.
+  const int lo[],                           // Bucket table.
+  const double &x_val)                      // Argument value to interpolate for.
+{
+  if (!(x_val >= x_arr[0])) return -1;
+  double t = (x_val - x_arr[0])*inv_w;
+  if (t >= (double)num) return n - 1;
+  int i = lo[(int)t];
+  if (i < 0) i = 0;
+  while (i < n - 1 && !(x_arr[i + 1] > x_val)) ++i;
+  return i;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  The same, starting from the interval found by the previous call. Sweeps over sorted arguments move the hint by
+  one or a few intervals, so the lookup is amortized O(1); far jumps fall back to the bucket table, so any order
+  of arguments gives the correct interval.
+----------------------------------------------------------------------------------------------------------------------*/
+inline int cursorInterval(
+  const int &n,                             // Size of arrays.
+  const double x_arr[],                     // Array of arguments, increasing.
+  const int &num,                           // Number of buckets.
+  const double &inv_w,                      // Inverse bucket width.
+  const int lo[],                           // Bucket table.
+  const double &x_val,                      // Argument value to interpolate for.
+  int &hint)                                // Interval of the previous call, updated.
+{
+  int i = hint;
+  if (i >= -1 && i <= n - 1) {
+    for (int step = 0; step < 4; ++step) {
+      if (i >= 0 && !(x_arr[i] <= x_val)) --i;
+      else if (i < n - 1 && !(x_arr[i + 1] > x_val)) ++i;
+      else return hint = i;
+    }
+  }
+  return hint = bucketInterval(n, x_arr, num, inv_w, lo, x_val);
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  First point of the 4-point stencil for the interval i, shifted inside the table at its ends.
+----------------------------------------------------------------------------------------------------------------------*/
+inline int stencilOf(
+  const int &n,                             // Size of arrays.
+  const int &i)                             // Interval: the last table point not greater than the argument.
+{
+  if(i < 1) return 1;
+  if(i > n - 3) return n - 3;
+  return i;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Position in a table kept between calls for sweeps over sorted arguments.
+----------------------------------------------------------------------------------------------------------------------*/
+struct TableCursor
+{
+  int interval;                             // Interval found by the previous lookup, -2 if none.
+
+  TableCursor() : interval(-2) {}
+};
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Interpolation procedure: the 4-point Lagrange formula on the stencil of interpStencil(). The material functions
+  evaluate the same cubics through CubicTable; this is the reference that the self-test checks them against.
+----------------------------------------------------------------------------------------------------------------------*/
+double interpolate(
+  const int &n,                             // Size of arrays.
+  const double x_arr[],                     // Array of arguments.
+  const double y_arr[],                     // Array of function values.
+  const double &x_val)                      // Argument value to interpolate for.
+{
+  const int i = interpStencil(n, x_arr, x_val);
+  double x[4], y[4];
+
+  x[0] = x_arr[i - 1];  y[0] = y_arr[i - 1];
+  x[1] = x_arr[i];      y[1] = y_arr[i];
+  x[2] = x_arr[i + 1];  y[2] = y_arr[i + 1];
+  x[3] = x_arr[i + 2];  y[3] = y_arr[i + 2];
+
+  return (x_val - x[1])*(x_val - x[2])*(x_val - x[3])*y[0]/((x[0] - x[1])*(x[0] - x[2])*(x[0] - x[3]))
+       + (x_val - x[0])*(x_val - x[2])*(x_val - x[3])*y[1]/((x[1] - x[0])*(x[1] - x[2])*(x[1] - x[3]))
+       + (x_val - x[0])*(x_val - x[1])*(x_val - x[3])*y[2]/((x[2] - x[0])*(x[2] - x[1])*(x[2] - x[3]))
+       + (x_val - x[0])*(x_val - x[1])*(x_val - x[2])*y[3]/((x[3] - x[0])*(x[3] - x[1])*(x[3] - x[2]));
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Coefficients of the 4-point Lagrange cubic on the stencil x_arr[i-1..i+2] in powers of t = x - x_arr[i].
+----------------------------------------------------------------------------------------------------------------------*/
+constexpr void cubicCoef(
+  const double x_arr[],                     // Array of arguments.
+  const double y_arr[],                     // Array of function values.
+  const int i,                              // First point of the stencil.
+  double c[4])                              // Output: coefficients c0..c3.
+{
+  // Newton form with nodes x[i], x[i+1], x[i-1], x[i+2].
+  double h1 = x_arr[i + 1] - x_arr[i];
+  double hm = x_arr[i - 1] - x_arr[i];
+  double h2 = x_arr[i + 2] - x_arr[i];
+  double f01 = (y_arr[i + 1] - y_arr[i])/h1;
+  double f0m = (y_arr[i - 1] - y_arr[i])/hm;
+  double f02 = (y_arr[i + 2] - y_arr[i])/h2;
+  double f01m = (f0m - f01)/(hm - h1);
+  double f012 = (f02 - f01)/(h2 - h1);
+  double d3 = (f012 - f01m)/(h2 - hm);
+
+  c[0] = y_arr[i];
+  c[1] = f01 - f01m*h1 + d3*h1*hm;
+  c[2] = f01m - d3*(h1 + hm);
+  c[3] = d3;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Piecewise-cubic form of the 4-point Lagrange interpolation of M functions tabulated at N fixed points, with
+  B buckets of the acceleration index. The whole object is built by the compiler: for every stencil the cubics
+  are stored in powers of t = x - x_arr[i], so each point costs one bucket lookup and a Horner scheme per
+  function instead of the Lagrange formula with its divisions. For M = 2 the coefficients of a stencil take
+  exactly one cache line.
+----------------------------------------------------------------------------------------------------------------------*/
+template <int N, int M, int B>
+class CubicTable
+{
+public:
+
+  constexpr CubicTable(
+    const double (&x_arr)[N],               // Array of arguments, increasing.
+    const double *const (&y_arr)[M]);       // Arrays of function values.
+
+  // Values of the M functions at x_val, the same as interpolate() up to rounding.
+  template <class T>
+  void eval(
+    const T &x_val,                         // Argument value to interpolate for.
+    T y_val[]) const;                       // Output: interpolated values.
+
+  // The same, with the interval search started from the cursor position.
+  template <class T>
+  void eval(
+    const T &x_val,                         // Argument value to interpolate for.
+    T y_val[],                              // Output: interpolated values.
+    TableCursor &cursor) const;             // Position of the previous lookup, updated.
+
+  const double *args() const { return x_; }
+
+private:
+
+  alignas(64) double coef_[N][4*M] = {};    // Coefficients c0..c3 of each function for each stencil.
+  alignas(64) double x_[N] = {};            // Array of arguments.
+  alignas(64) int lo_[B + 1] = {};          // Bucket table.
+  double inv_w_ = 0.0;                      // Inverse bucket width.
+
+  template <class T>
+  void evalStencil(
+    const int &i,                           // First point of the stencil.
+    const T &x_val,                         // Argument value to interpolate for.
+    T y_val[]) const;                       // Output: interpolated values.
+};
+
+
+template <int N, int M, int B>
+constexpr CubicTable<N, M, B>::CubicTable(
+  const double (&x_arr)[N],                 // Array of arguments, increasing.
+  const double *const (&y_arr)[M])          // Arrays of function values.
+{
+  for (int i = 0; i < N; ++i)
+    x_[i] = x_arr[i];
+  for (int i = 1; i <= N - 3; ++i)
+    for (int j = 0; j < M; ++j)
+      cubicCoef(x_arr, y_arr[j], i, coef_[i] + 4*j);
+  fillBuckets(N, x_arr, B, lo_);
+  inv_w_ = B/(x_arr[N - 1] - x_arr[0]);
+}
+
+
+template <int N, int M, int B>
+template <class T>
+inline void CubicTable<N, M, B>::evalStencil(
+  const int &i,                             // First point of the stencil.
+  const T &x_val,                           // Argument value to interpolate for.
+  T y_val[]) const                          // Output: interpolated values.
+{
+  T t = x_val - x_[i];
+  const double *c = coef_[i];
+  for (int j = 0; j < M; ++j, c += 4)
+    y_val[j] = c[0] + t*(c[1] + t*(c[2] + t*c[3]));
+}
+
+
+template <int N, int M, int B>
+template <class T>
+inline void CubicTable<N, M, B>::eval(
+  const T &x_val,                           // Argument value to interpolate for.
+  T y_val[]) const                          // Output: interpolated values.
+{
+  evalStencil(stencilOf(N, bucketInterval(N, x_, B, inv_w_, lo_, scalarValue(x_val))), x_val, y_val);
+}
+
+
+template <int N, int M, int B>
+template <class T>
+inline void CubicTable<N, M, B>::eval(
+  const T &x_val,                           // Argument value to interpolate for.
+  T y_val[],                                // Output: interpolated values.
+  TableCursor &cursor) const                // Position of the previous lookup, updated.
+{
+  const double x = scalarValue(x_val);
+  evalStencil(stencilOf(N, cursorInterval(N, x_, B, inv_w_, lo_, x, cursor.interval)), x_val, y_val);
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Parameters of the size-dependent free-electron damping.
+----------------------------------------------------------------------------------------------------------------------*/
+struct DrudeParams
+{
+  double vF;                                // cm/s (Fermi velocity).
+  double lam_inf;                           // cm (mean electron free path).
+  double omega_p;                           // eV (plasma angular frequency).
+  double A;                                 // empirical constant.
+};
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Size correction of the dielectric function: the bulk free-electron term is replaced by the one with the damping
+  increased by surface scattering in a particle of size D.
+----------------------------------------------------------------------------------------------------------------------*/
+template <class T>
+typename ModelNumber<T>::complex sizeCorrection(
+  const DrudeParams &p,                     // Free-electron parameters of the material.
+  const T &lambda,                          // Wavelength in nm.
+  const T &D)                               // Size parameter in nm.
+{
+  const typename ModelNumber<T>::complex IRE(1.0, 0.0);
+  const typename ModelNumber<T>::complex IIM(0.0, 1.0);
+
+  const double h_bar = 6.582e-16;
+  const T gam_inf = h_bar*p.vF/p.lam_inf;
+  const T gam_r = gam_inf + p.A*h_bar*p.vF*1.0e7*(2.0/D);
+
+  T omega = 1239.8/lambda;
+
+  return T(p.omega_p*p.omega_p)*( IRE/(IRE*omega*omega + IIM*omega*gam_inf)
+                                - IRE/(IRE*omega*omega + IIM*omega*gam_r) );
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Optical constants of silver from [Johnson P.B., Christy R.W. Phys. Rev. B, 6, 470 (1972).]: photon energy in eV,
+  refractive index and extinction coefficient, their piecewise-cubic interpolation table and free-electron
+  parameters.
+----------------------------------------------------------------------------------------------------------------------*/
+constexpr int ag_num = 49;
+constexpr double ag_energy[] = { 0.64, 0.77, 0.89, 1.02, 1.14, 1.26, 1.39, 1.51, 1.64, 1.76,
+                                 1.88, 2.01, 2.13, 2.26, 2.38, 2.50, 2.63, 2.75, 2.88, 3.00,
+                                 3.12, 3.25, 3.37, 3.50, 3.62, 3.74, 3.87, 3.99, 4.12, 4.24,
+                                 4.36, 4.49, 4.61, 4.74, 4.86, 4.98, 5.11, 5.23, 5.36, 5.48,
+                                 5.60, 5.73, 5.85, 5.98, 6.10, 6.22, 6.35, 6.47, 6.60 };
+
+constexpr double ag_ndata[]  = { 0.24, 0.15, 0.13, 0.09, 0.04, 0.04, 0.04, 0.04, 0.03, 0.04,
+                                 0.05, 0.06, 0.05, 0.06, 0.05, 0.05, 0.05, 0.04, 0.04, 0.05,
+                                 0.05, 0.05, 0.07, 0.10, 0.14, 0.17, 0.81, 1.13, 1.34, 1.39,
+                                 1.41, 1.41, 1.38, 1.35, 1.33, 1.31, 1.30, 1.28, 1.28, 1.26,
+                                 1.25, 1.22, 1.20, 1.18, 1.15, 1.14, 1.12, 1.10, 1.07 };
+
+constexpr double ag_kdata[]  = { 14.080, 11.85, 10.10, 8.828, 7.795, 6.992, 6.312, 5.727, 5.242, 4.838,
+                                 4.483, 4.152, 3.858, 3.586, 3.324, 3.093, 2.869, 2.657, 2.462, 2.275,
+                                 2.070, 1.864, 1.657, 1.419, 1.142, 0.829, 0.392, 0.616, 0.964, 1.161,
+                                 1.264, 1.331, 1.372, 1.387, 1.393, 1.389, 1.378, 1.367, 1.357, 1.344,
+                                 1.342, 1.336, 1.325, 1.312, 1.296, 1.277, 1.255, 1.232, 1.212 };
+
+constexpr CubicTable<ag_num, 2, bucketCount(ag_num, ag_energy)> ag_table(ag_energy, { ag_ndata, ag_kdata });
+
+constexpr DrudeParams ag_drude = { 1.39e8, 5.2e-6, 9.1, 2.5 };  // vF, lam_inf, omega_p, A.
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Dielectric function of silver from [Johnson P.B., Christy R.W. Phys. Rev. B, 6, 470 (1972).]
+----------------------------------------------------------------------------------------------------------------------*/
+template <class T>
+typename ModelNumber<T>::complex epsAg(
+  const T &lambda,                          // Wavelength in nm.
+  TableCursor &cursor)                      // Table position of the previous call, updated.
+{
+  const typename ModelNumber<T>::complex IRE(1.0, 0.0);
+  const typename ModelNumber<T>::complex IIM(0.0, 1.0);
+
+  T omega = 1239.8/lambda;
+
+  if ((omega < ag_energy[0]) && (omega > ag_energy[ag_num - 1])) {
+    std::cout << "Argument of dielectric function of silver is out of range" << std::endl;
+    exit(0);
+  }
+
+  T nk[2];
+  ag_table.eval(omega, nk, cursor);
+  T n_val = nk[0];
+  T k_val = nk[1];
+
+  return IRE*(n_val*n_val - k_val*k_val) + IIM*(2.0*n_val*k_val);
+}
+
+
+template <class T>
+typename ModelNumber<T>::complex epsAg(
+  const T &lambda)                          // Wavelength in nm.
+{
+  TableCursor cursor;
+  return epsAg(lambda, cursor);
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Size-dependent dielectric function of silver.
+----------------------------------------------------------------------------------------------------------------------*/
+template <class T>
+typename ModelNumber<T>::complex epsAgSD(
+  const T &lambda,                          // Wavelength in nm.
+  const T &D,                               // Size parameter in nm.
+  TableCursor &cursor)                      // Table position of the previous call, updated.
+{
+  return epsAg(lambda, cursor) + sizeCorrection(ag_drude, lambda, D);
+}
+
+
+template <class T>
+typename ModelNumber<T>::complex epsAgSD(
+  const T &lambda,                          // Wavelength in nm.
+  const T &D)                               // Size parameter in nm.
+{
+  TableCursor cursor;
+  return epsAgSD(lambda, D, cursor);
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  The silver functions for double arguments, converting the arguments of other arithmetic types.
+----------------------------------------------------------------------------------------------------------------------*/
+std::complex<double> epsAg(
+  const double &lambda,                     // Wavelength in nm.
+  TableCursor &cursor)                      // Table position of the previous call, updated.
+{
+  return epsAg<double>(lambda, cursor);
+}
+
+
+std::complex<double> epsAg(
+  const double &lambda)                     // Wavelength in nm.
+{
+  return epsAg<double>(lambda);
+}
+
+
+std::complex<double> epsAgSD(
+  const double &lambda,                     // Wavelength in nm.
+  const double &D,                          // Size parameter in nm.
+  TableCursor &cursor)                      // Table position of the previous call, updated.
+{
+  return epsAgSD<double>(lambda, D, cursor);
+}
+
+
+std::complex<double> epsAgSD(
+  const double &lambda,                     // Wavelength in nm.
+  const double &D)                          // Size parameter in nm.
+{
+  return epsAgSD<double>(lambda, D);
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Optical constants of gold from [R. L. Olmon, B. Slovick, T. W. Johnson, D. Shelton, S.-H. Oh, G. D. Boreman,
+  and M. B. Raschke. Phys. Rev. B, 86, 235147 (2012).]: photon energy in eV, refractive index and extinction
+  coefficient, their piecewise-cubic interpolation table and free-electron parameters.
+----------------------------------------------------------------------------------------------------------------------*/
+constexpr int au_num = 448;
+constexpr double au_energy[] = { 0.0497329, 0.0516601, 0.0535569, 0.0554739, 0.0574001, 0.0592942, 0.0612268, 0.0631284,
+  0.0650494, 0.0669461, 0.0688801, 0.0707672, 0.0726754, 0.0745994, 0.0765334, 0.0784214, 0.0803527, 0.0822722,
+  0.0841712, 0.0861001, 0.0879944, 0.0899088, 0.0918401, 0.0937144, 0.0956668, 0.0975485, 0.0995058, 0.101377, 0.10332,
+  0.10525, 0.10716, 0.109045, 0.110997, 0.112815, 0.1148, 0.116636, 0.118645, 0.12049, 0.122393, 0.124345, 0.126257,
+  0.128176, 0.130085, 0.131996, 0.133907, 0.135828, 0.13773, 0.139653, 0.141567, 0.143467, 0.145385, 0.147302, 0.149217,
+  0.151126, 0.153048, 0.154961, 0.156863, 0.158771, 0.160685, 0.162602, 0.164523, 0.166422, 0.168342, 0.170261,
+  0.172176, 0.174086, 0.175989, 0.177908, 0.179818, 0.181742, 0.183653, 0.18555, 0.187486, 0.189376, 0.191304, 0.193212,
+  0.195128, 0.197051, 0.198948, 0.200849, 0.202787, 0.204696, 0.206606, 0.208517, 0.210428, 0.212338, 0.214246,
+  0.216151, 0.21809, 0.219986, 0.221915, 0.223839, 0.225713, 0.227661, 0.229558, 0.231487, 0.233404, 0.235309, 0.237199,
+  0.239121, 0.241027, 0.242963, 0.244883, 0.246784, 0.248665, 0.250625, 0.252514, 0.254431, 0.256325, 0.258247,
+  0.260143, 0.262068, 0.263965, 0.265889, 0.267842, 0.269707, 0.271657, 0.273575, 0.275459, 0.27737, 0.279307, 0.281207,
+  0.283134, 0.285021, 0.286934, 0.288873, 0.29077, 0.292692, 0.294569, 0.296542, 0.298398, 0.300349, 0.302253, 0.304181,
+  0.306058, 0.307959, 0.309883, 0.311831, 0.313725, 0.315642, 0.317582, 0.319465, 0.321369, 0.323296, 0.325247,
+  0.327135, 0.329045, 0.330978, 0.332843, 0.334731, 0.336639, 0.33857, 0.340522, 0.342403, 0.344305, 0.346228, 0.348172,
+  0.35004, 0.352028, 0.353937, 0.355765, 0.357715, 0.359687, 0.361575, 0.363483, 0.365412, 0.367252, 0.36922, 0.371099,
+  0.372997, 0.374914, 0.376852, 0.378809, 0.38067, 0.382549, 0.384566, 0.386364, 0.3883, 0.390256, 0.392107, 0.394101,
+  0.395989, 0.397895, 0.39982, 0.401763, 0.403594, 0.405575, 0.407441, 0.409324, 0.411224, 0.413143, 0.415079, 0.417034,
+  0.419007, 0.420856, 0.422721, 0.424749, 0.426649, 0.428566, 0.430351, 0.432302, 0.43427, 0.436103, 0.438107, 0.439972,
+  0.441854, 0.443752, 0.445666, 0.447596, 0.449544, 0.451508, 0.453324, 0.455322, 0.457169, 0.459031, 0.461079,
+  0.462973, 0.464883, 0.466808, 0.468749, 0.470528, 0.472501, 0.47449, 0.476313, 0.47815, 0.480187, 0.482054, 0.483935,
+  0.485831, 0.487743, 0.489669, 0.491611, 0.493568, 0.49554, 0.497329, 0.499332, 0.501149, 0.503183, 0.505027, 0.506885,
+  0.508757, 0.510854, 0.512755, 0.514671, 0.518329, 0.520286, 0.522259, 0.524246, 0.526025, 0.528042, 0.529847,
+  0.533724, 0.535569, 0.537426, 0.539531, 0.543314, 0.545225, 0.54715, 0.549088, 0.55276, 0.554739, 0.556732, 0.558487,
+  0.562287, 0.564334, 0.566138, 0.570042, 0.571883, 0.575867, 0.577745, 0.579636, 0.583455, 0.585383, 0.589278,
+  0.590964, 0.594934, 0.596939, 0.600699, 0.60245, 0.60628, 0.608362, 0.612268, 0.614087, 0.617759, 0.619921, 0.623036,
+  0.626183, 0.629361, 0.632572, 0.635816, 0.639094, 0.642405, 0.645751, 0.649132, 0.652548, 0.656001, 0.65949, 0.663017,
+  0.666582, 0.670185, 0.673827, 0.677509, 0.681232, 0.684995, 0.688801, 0.692649, 0.69654, 0.700476, 0.704456, 0.708481,
+  0.712553, 0.716672, 0.720838, 0.725054, 0.729319, 0.733634, 0.738001, 0.74242, 0.746893, 0.751419, 0.756001, 0.760639,
+  0.765334, 0.770088, 0.774901, 0.779775, 0.78471, 0.789708, 0.79477, 0.799898, 0.805092, 0.810354, 0.815685, 0.821087,
+  0.826561, 0.832109, 0.837731, 0.84343, 0.849207, 0.855063, 0.861001, 0.867022, 0.918401, 0.925255, 0.932212, 0.939274,
+  0.946444, 0.953724, 0.961118, 0.968626, 0.976253, 0.984001, 0.991873, 0.999872, 1.008, 1.01626, 1.02466, 1.0332,
+  1.04188, 1.05071, 1.05969, 1.06883, 1.07812, 1.08758, 1.09721, 1.107, 1.11697, 1.12713, 1.13747, 1.148, 1.15873,
+  1.16966, 1.1808, 1.19216, 1.20373, 1.21553, 1.22757, 1.23984, 1.25237, 1.26514, 1.27819, 1.2915, 1.3051, 1.31898,
+  1.33316, 1.34765, 1.36246, 1.3776, 1.39308, 1.40891, 1.42511, 1.44168, 1.45864, 1.476, 1.49379, 1.512, 1.53067,
+  1.5498, 1.56942, 1.58954, 1.61018, 1.63137, 1.65312, 1.67546, 1.69841, 1.722, 1.74626, 1.7712, 1.79687, 1.8233,
+  1.85051, 1.87855, 1.90745, 1.93725, 1.968, 1.99974, 2.03253, 2.0664, 2.10143, 2.13766, 2.17516, 2.214, 2.25426, 2.296,
+  2.33932, 2.38431, 2.43106, 2.47968, 2.53029, 2.583, 2.63796, 2.69531, 2.7552, 2.81782, 2.88335, 2.952, 3.024, 3.0996,
+  3.17908, 3.26274, 3.35092, 3.444, 3.54241, 3.64659, 3.7571, 3.87451, 3.99949, 4.13281 };
+
+constexpr double au_ndata[]  = { 42.79, 40.92, 39.16, 37.49, 35.91, 34.41, 33, 31.66, 30.39, 29.19, 28.05, 26.97, 25.94,
+  24.97, 24.04, 23.17, 22.33, 21.54, 20.78, 20.06, 19.38, 18.72, 18.1, 17.51, 16.94, 16.4, 15.88, 15.38, 14.91, 14.46,
+  14.02, 13.61, 13.21, 12.83, 12.46, 12.11, 11.77, 11.45, 11.14, 10.84, 10.55, 10.27, 10.01, 9.749, 9.502, 9.263, 9.034,
+  8.812, 8.598, 8.392, 8.193, 8, 7.814, 7.634, 7.461, 7.293, 7.13, 6.973, 6.82, 6.673, 6.53, 6.392, 6.258, 6.127, 6.001,
+  5.879, 5.76, 5.645, 5.533, 5.424, 5.319, 5.216, 5.117, 5.02, 4.926, 4.834, 4.745, 4.658, 4.574, 4.492, 4.412, 4.334,
+  4.258, 4.184, 4.112, 4.042, 3.973, 3.906, 3.841, 3.778, 3.716, 3.655, 3.596, 3.539, 3.482, 3.427, 3.374, 3.321, 3.27,
+  3.22, 3.171, 3.123, 3.077, 3.031, 2.986, 2.942, 2.899, 2.858, 2.817, 2.776, 2.737, 2.699, 2.661, 2.624, 2.588, 2.553,
+  2.518, 2.484, 2.451, 2.418, 2.386, 2.355, 2.324, 2.294, 2.264, 2.235, 2.207, 2.179, 2.152, 2.125, 2.098, 2.072, 2.047,
+  2.022, 1.998, 1.974, 1.95, 1.927, 1.904, 1.881, 1.859, 1.838, 1.817, 1.796, 1.775, 1.755, 1.735, 1.716, 1.697, 1.678,
+  1.659, 1.641, 1.623, 1.605, 1.588, 1.571, 1.554, 1.538, 1.521, 1.505, 1.49, 1.474, 1.459, 1.444, 1.429, 1.414, 1.4,
+  1.386, 1.372, 1.358, 1.345, 1.331, 1.318, 1.305, 1.293, 1.28, 1.268, 1.256, 1.244, 1.232, 1.22, 1.209, 1.197, 1.186,
+  1.175, 1.164, 1.153, 1.143, 1.132, 1.122, 1.112, 1.102, 1.092, 1.082, 1.073, 1.063, 1.054, 1.045, 1.036, 1.027, 1.018,
+  1.009, 1, 0.9919, 0.9835, 0.9752, 0.967, 0.9589, 0.9509, 0.943, 0.9352, 0.9275, 0.9199, 0.9123, 0.9049, 0.8976,
+  0.8904, 0.8832, 0.8761, 0.8692, 0.8623, 0.8554, 0.8487, 0.8421, 0.8355, 0.829, 0.8226, 0.8162, 0.8099, 0.8037, 0.7976,
+  0.7916, 0.7856, 0.7797, 0.7738, 0.768, 0.7623, 0.7566, 0.7511, 0.7455, 0.7401, 0.7347, 0.7293, 0.724, 0.7136, 0.7085,
+  0.7034, 0.6984, 0.6935, 0.6886, 0.6837, 0.6742, 0.6695, 0.6649, 0.6603, 0.6512, 0.6468, 0.6423, 0.638, 0.6294, 0.6252,
+  0.621, 0.6168, 0.6087, 0.6047, 0.6007, 0.5929, 0.589, 0.5814, 0.5776, 0.5739, 0.5666, 0.563, 0.5559, 0.5524, 0.5455,
+  0.5421, 0.5354, 0.5321, 0.5256, 0.5224, 0.516, 0.5129, 0.5068, 0.5031, 0.4989, 0.4942, 0.4896, 0.4851, 0.4805, 0.476,
+  0.4715, 0.4671, 0.4627, 0.4583, 0.454, 0.4497, 0.4454, 0.4412, 0.4369, 0.4328, 0.4286, 0.4245, 0.4204, 0.4163, 0.4123,
+  0.4082, 0.4042, 0.4003, 0.3963, 0.3924, 0.3885, 0.3847, 0.3808, 0.377, 0.3732, 0.3695, 0.3657, 0.362, 0.3583, 0.3546,
+  0.351, 0.3474, 0.3437, 0.3402, 0.3366, 0.3331, 0.3295, 0.326, 0.3226, 0.3191, 0.3157, 0.3123, 0.3089, 0.3055, 0.3021,
+  0.2988, 0.2955, 0.2922, 0.2889, 0.2857, 0.2824, 0.2551, 0.252, 0.249, 0.246, 0.243, 0.24, 0.2371, 0.2342, 0.2313,
+  0.2281, 0.225, 0.2218, 0.2187, 0.2157, 0.2126, 0.2096, 0.2066, 0.2036, 0.2007, 0.1978, 0.1949, 0.1921, 0.1893, 0.1865,
+  0.1837, 0.181, 0.1783, 0.1757, 0.1731, 0.1705, 0.168, 0.1655, 0.163, 0.1606, 0.1582, 0.1559, 0.1536, 0.1514, 0.1493,
+  0.1471, 0.1451, 0.1431, 0.1412, 0.1393, 0.1375, 0.1358, 0.1342, 0.1326, 0.1312, 0.1298, 0.1286, 0.1275, 0.1265,
+  0.1256, 0.1249, 0.1244, 0.124, 0.1239, 0.1239, 0.1242, 0.1248, 0.1257, 0.1268, 0.1284, 0.1304, 0.1328, 0.1358, 0.1394,
+  0.1436, 0.1487, 0.1546, 0.1616, 0.1698, 0.1794, 0.1908, 0.2041, 0.2199, 0.2388, 0.2617, 0.2899, 0.3256, 0.3724,
+  0.4363, 0.5263, 0.6527, 0.8197, 1.011, 1.193, 1.333, 1.422, 1.472, 1.505, 1.537, 1.567, 1.585, 1.588, 1.585, 1.588,
+  1.606, 1.637, 1.671, 1.695, 1.701, 1.685, 1.649, 1.596 };
+
+constexpr double au_kdata[]  = { 137.5, 133.9, 130.4, 127.1, 124, 121, 118.2, 115.5, 112.9, 110.4, 108.1, 105.8, 103.6,
+  101.5, 99.47, 97.52, 95.64, 93.83, 92.08, 90.39, 88.76, 87.18, 85.66, 84.18, 82.76, 81.37, 80.03, 78.73, 77.47, 76.25,
+  75.07, 73.91, 72.8, 71.71, 70.65, 69.63, 68.63, 67.65, 66.71, 65.78, 64.89, 64.01, 63.16, 62.33, 61.52, 60.73, 59.96,
+  59.2, 58.47, 57.75, 57.05, 56.37, 55.7, 55.04, 54.4, 53.78, 53.17, 52.57, 51.98, 51.41, 50.85, 50.3, 49.76, 49.24,
+  48.72, 48.21, 47.72, 47.23, 46.76, 46.29, 45.83, 45.38, 44.94, 44.51, 44.08, 43.67, 43.26, 42.85, 42.46, 42.07, 41.69,
+  41.32, 40.95, 40.59, 40.23, 39.88, 39.54, 39.2, 38.87, 38.54, 38.22, 37.9, 37.59, 37.29, 36.98, 36.69, 36.4, 36.11,
+  35.82, 35.55, 35.27, 35, 34.73, 34.47, 34.21, 33.96, 33.71, 33.46, 33.21, 32.97, 32.74, 32.5, 32.27, 32.04, 31.82,
+  31.6, 31.38, 31.16, 30.95, 30.74, 30.53, 30.33, 30.13, 29.93, 29.73, 29.54, 29.34, 29.15, 28.97, 28.78, 28.6, 28.42,
+  28.24, 28.07, 27.89, 27.72, 27.55, 27.38, 27.22, 27.06, 26.89, 26.73, 26.58, 26.42, 26.27, 26.11, 25.96, 25.81, 25.67,
+  25.52, 25.38, 25.23, 25.09, 24.95, 24.81, 24.68, 24.54, 24.41, 24.28, 24.14, 24.01, 23.89, 23.76, 23.63, 23.51, 23.39,
+  23.26, 23.14, 23.02, 22.91, 22.79, 22.67, 22.56, 22.45, 22.33, 22.22, 22.11, 22, 21.89, 21.79, 21.68, 21.57, 21.47,
+  21.37, 21.26, 21.16, 21.06, 20.96, 20.86, 20.77, 20.67, 20.57, 20.48, 20.38, 20.29, 20.2, 20.11, 20.02, 19.93, 19.84,
+  19.75, 19.66, 19.57, 19.49, 19.4, 19.32, 19.23, 19.15, 19.06, 18.98, 18.9, 18.82, 18.74, 18.66, 18.58, 18.5, 18.43,
+  18.35, 18.27, 18.2, 18.12, 18.05, 17.97, 17.9, 17.83, 17.75, 17.68, 17.61, 17.54, 17.47, 17.4, 17.33, 17.26, 17.2,
+  17.13, 17.06, 17, 16.93, 16.86, 16.8, 16.73, 16.67, 16.61, 16.54, 16.42, 16.36, 16.3, 16.24, 16.17, 16.11, 16.06,
+  15.94, 15.88, 15.82, 15.76, 15.65, 15.59, 15.54, 15.48, 15.37, 15.32, 15.26, 15.21, 15.1, 15.05, 15, 14.89, 14.84,
+  14.74, 14.69, 14.64, 14.54, 14.49, 14.39, 14.35, 14.25, 14.2, 14.11, 14.06, 13.97, 13.93, 13.84, 13.79, 13.7, 13.65,
+  13.59, 13.52, 13.46, 13.39, 13.32, 13.25, 13.19, 13.12, 13.05, 12.99, 12.92, 12.85, 12.78, 12.72, 12.65, 12.58, 12.52,
+  12.45, 12.38, 12.31, 12.25, 12.18, 12.11, 12.04, 11.98, 11.91, 11.84, 11.77, 11.71, 11.64, 11.57, 11.5, 11.44, 11.37,
+  11.3, 11.23, 11.16, 11.1, 11.03, 10.96, 10.89, 10.82, 10.76, 10.69, 10.62, 10.55, 10.48, 10.41, 10.35, 10.28, 10.21,
+  10.14, 10.07, 10, 9.934, 9.865, 9.796, 9.214, 9.145, 9.075, 9.005, 8.935, 8.865, 8.795, 8.725, 8.655, 8.581, 8.506,
+  8.432, 8.358, 8.283, 8.208, 8.134, 8.059, 7.984, 7.909, 7.834, 7.759, 7.683, 7.608, 7.532, 7.456, 7.38, 7.304, 7.228,
+  7.152, 7.075, 6.999, 6.922, 6.845, 6.768, 6.69, 6.613, 6.535, 6.457, 6.379, 6.301, 6.222, 6.143, 6.064, 5.985, 5.905,
+  5.825, 5.745, 5.664, 5.583, 5.501, 5.42, 5.338, 5.255, 5.172, 5.088, 5.004, 4.92, 4.834, 4.749, 4.662, 4.575, 4.487,
+  4.398, 4.308, 4.217, 4.126, 4.033, 3.938, 3.843, 3.746, 3.647, 3.547, 3.444, 3.34, 3.232, 3.122, 3.009, 2.891, 2.769,
+  2.641, 2.507, 2.364, 2.213, 2.058, 1.908, 1.787, 1.72, 1.716, 1.758, 1.812, 1.855, 1.877, 1.887, 1.898, 1.911, 1.915,
+  1.904, 1.877, 1.846, 1.825, 1.821, 1.835, 1.858, 1.881, 1.895, 1.888 };
+
+constexpr CubicTable<au_num, 2, bucketCount(au_num, au_energy)> au_table(au_energy, { au_ndata, au_kdata });
+
+constexpr DrudeParams au_drude = { 1.38e8, 1.28e-6, 9.0, 2.0 };  // vF, lam_inf, omega_p, A.
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Dielectric function of gold from [R. L. Olmon, B. Slovick, T. W. Johnson, D. Shelton, S.-H. Oh,
+  G. D. Boreman, and M. B. Raschke. Phys. Rev. B, 86, 235147 (2012).]
+----------------------------------------------------------------------------------------------------------------------*/
+template <class T>
+typename ModelNumber<T>::complex epsAu(
+  const T &lambda,                          // Wavelength in nm.
+  TableCursor &cursor)                      // Table position of the previous call, updated.
+{
+  const typename ModelNumber<T>::complex IRE(1.0, 0.0);
+  const typename ModelNumber<T>::complex IIM(0.0, 1.0);
+
+  T omega = 1239.8/lambda;
+
+  if ((omega < au_energy[0]) && (omega > au_energy[au_num - 1])) {
+    std::cout << "Argument of dielectric function of gold is out of range" << std::endl;
+    exit(0);
+  }
+
+  T nk[2];
+  au_table.eval(omega, nk, cursor);
+  T n_val = nk[0];
+  T k_val = nk[1];
+
+  return IRE*(n_val*n_val - k_val*k_val) + IIM*(2.0*n_val*k_val);
+}
+
+
+template <class T>
+typename ModelNumber<T>::complex epsAu(
+  const T &lambda)                          // Wavelength in nm.
+{
+  TableCursor cursor;
+  return epsAu(lambda, cursor);
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Size-dependent dielectric function of gold.
+----------------------------------------------------------------------------------------------------------------------*/
+template <class T>
+typename ModelNumber<T>::complex epsAuSD(
+  const T &lambda,                          // Wavelength in nm.
+  const T &D,                               // Size parameter in nm.
+  TableCursor &cursor)                      // Table position of the previous call, updated.
+{
+  return epsAu(lambda, cursor) + sizeCorrection(au_drude, lambda, D);
+}
+
+
+template <class T>
+typename ModelNumber<T>::complex epsAuSD(
+  const T &lambda,                          // Wavelength in nm.
+  const T &D)                               // Size parameter in nm.
+{
+  TableCursor cursor;
+  return epsAuSD(lambda, D, cursor);
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  The gold functions for double arguments, converting the arguments of other arithmetic types.
+----------------------------------------------------------------------------------------------------------------------*/
+std::complex<double> epsAu(
+  const double &lambda,                     // Wavelength in nm.
+  TableCursor &cursor)                      // Table position of the previous call, updated.
+{
+  return epsAu<double>(lambda, cursor);
+}
+
+
+std::complex<double> epsAu(
+  const double &lambda)                     // Wavelength in nm.
+{
+  return epsAu<double>(lambda);
+}
+
+
+std::complex<double> epsAuSD(
+  const double &lambda,                     // Wavelength in nm.
+  const double &D,                          // Size parameter in nm.
+  TableCursor &cursor)                      // Table position of the previous call, updated.
+{
+  return epsAuSD<double>(lambda, D, cursor);
+}
+
+
+std::complex<double> epsAuSD(
+  const double &lambda,                     // Wavelength in nm.
+  const double &D)                          // Size parameter in nm.
+{
+  return epsAuSD<double>(lambda, D);
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Diameter of a sphere of the same volume as the prism with equilateral triangle base.
+----------------------------------------------------------------------------------------------------------------------*/
+template <class T>
+typename ModelNumber<T>::type diameter(
+  const T &L,                               // Edge length in nm.
+  const T &H)                               // Thickness in nm.
+{
+  return 2.0*pow( (3.0*sqrt(3.0)*L*L*H/(16.0*M_PI)), 1.0/3.0 );
+}
+
+
+double diameter(
+  const double &L,                          // Edge length in nm.
+  const double &H)                          // Thickness in nm.
+{
+  return diameter<double>(L, H);
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Bulk dielectric function of silver or gold tabulated on a fixed wavelength grid. The table interpolation is done
+  once per wavelength on construction; all particles evaluated on the grid then take the bulk value by index and
+  add only their size correction.
+----------------------------------------------------------------------------------------------------------------------*/
+class DielectricCache
+{
+public:
+
+  DielectricCache(
+    const bool &is_silver,                  // Material: true - silver, false - gold.
+    const int &n,                           // Number of wavelength points.
+    const double lambda[]);                 // Wavelengths in nm.
+
+  // Bulk permittivity at the i-th wavelength.
+  std::complex<double> bulk(
+    const int &i) const                     // Wavelength index.
+  { return std::complex<double>(eps_re_[i], eps_im_[i]); }
+
+  // Size-dependent permittivity at the i-th wavelength, the same as epsAgSD/epsAuSD.
+  std::complex<double> sizeDependent(
+    const int &i,                           // Wavelength index.
+    const double &D) const;                 // Size parameter in nm.
+
+  // Size-dependent permittivity on the whole grid for n_D sizes. The output arrays hold size()*n_D values,
+  // the spectrum of the k-th size starting at k*size().
+  void sizeDependentBatch(
+    const int &n_D,                         // Number of sizes.
+    const double D[],                       // Size parameters in nm.
+    double eps_re[],                        // Output: real part of permittivity.
+    double eps_im[]) const;                 // Output: imaginary part of permittivity.
+
+  int size() const { return (int)lambda_.size(); }
+  bool isSilver() const { return is_silver_; }
+  const DrudeParams &drude() const { return is_silver_ ? ag_drude : au_drude; }
+  const double *wavelengths() const { return lambda_.data(); }
+  const double *bulkRe() const { return eps_re_.data(); }
+  const double *bulkIm() const { return eps_im_.data(); }
+
+private:
+
+  bool is_silver_;                          // Material.
+  std::vector<double> lambda_;              // Wavelengths in nm.
+  std::vector<double> eps_re_, eps_im_;     // Bulk permittivity.
+  std::vector<double> omega_;               // Photon energies in eV.
+  std::vector<double> base_re_, base_im_;   // Bulk permittivity with the bulk free-electron term added back.
+};
+
+
+DielectricCache::DielectricCache(
+  const bool &is_silver,                    // Material: true - silver, false - gold.
+  const int &n,                             // Number of wavelength points.
+  const double lambda[])                    // Wavelengths in nm.
+  : is_silver_(is_silver), lambda_(lambda, lambda + n), eps_re_(n), eps_im_(n), omega_(n), base_re_(n), base_im_(n)
+{
+  const std::complex<double> IRE(1.0, 0.0);
+  const std::complex<double> IIM(0.0, 1.0);
+
+  const DrudeParams &p = drude();
+  const double h_bar = 6.582e-16;
+  const double gam_inf = h_bar*p.vF/p.lam_inf;
+
+  TableCursor cursor;
+  for (int i = 0; i < n; ++i) {
+    std::complex<double> eps = is_silver ? epsAg(lambda[i], cursor) : epsAu(lambda[i], cursor);
+    eps_re_[i] = std::real(eps);
+    eps_im_[i] = std::imag(eps);
+
+    omega_[i] = 1239.8/lambda[i];
+    std::complex<double> base = eps + p.omega_p*p.omega_p*IRE/(IRE*omega_[i]*omega_[i] + IIM*omega_[i]*gam_inf);
+    base_re_[i] = std::real(base);
+    base_im_[i] = std::imag(base);
+  }
+}
+
+
+inline std::complex<double> DielectricCache::sizeDependent(
+  const int &i,                             // Wavelength index.
+  const double &D) const                    // Size parameter in nm.
+{
+  return bulk(i) + sizeCorrection(drude(), lambda_[i], D);
+}
+
+
+void DielectricCache::sizeDependentBatch(
+  const int &n_D,                           // Number of sizes.
+  const double D[],                         // Size parameters in nm.
+  double eps_re[],                          // Output: real part of permittivity.
+  double eps_im[]) const                    // Output: imaginary part of permittivity.
+{
+  static const DrudeKernel kernel = drudeKernel();
+  const DrudeParams &p = drude();
+  const double h_bar = 6.582e-16;
+  const double gam_inf = h_bar*p.vF/p.lam_inf;
+  const int n = size();
+  for (int k = 0; k < n_D; ++k) {
+    const double gam_r = gam_inf + p.A*h_bar*p.vF*1.0e7*(2.0/D[k]);
+    kernel(n, omega_.data(), base_re_.data(), base_im_.data(), p.omega_p*p.omega_p, gam_r,
+           eps_re + (size_t)k*n, eps_im + (size_t)k*n);
+  }
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Cross sections of a prism with the size-dependent permittivity at D = diameter(L, H), and their derivatives by
+  L, H, R, eps_h and lambda, from one evaluation in dual numbers.
+----------------------------------------------------------------------------------------------------------------------*/
+enum GradientVar { GRAD_L, GRAD_H, GRAD_R, GRAD_EPS_H, GRAD_LAMBDA, GRAD_VARS };
+
+typedef Dual<GRAD_VARS> GradientDual;
+typedef ModelNumber<GradientDual>::complex GradientComplex;
+
+void crossSectionGradient(
+  const double &lambda,                     // Wavelength in nm.
+  const double &L,                          // Edge length in nm.
+  const double &H,                          // Thickness in nm.
+  const double &R,                          // Triangle base corner radius in nm.
+  const double &eps_h,                      // Dielectric permittivity of host media.
+  const bool &is_silver,                    // Material: true - silver, false - gold.
+  TableCursor &cursor,                      // Table position of the previous call, updated.
+  GradientDual &c_sca,                      // Output: scattering cross section in cm^2 with its gradient.
+  GradientDual &c_ext)                      // Output: extinction cross section in cm^2 with its gradient.
+{
+  const GradientDual x_L(L, GRAD_L), x_H(H, GRAD_H), x_R(R, GRAD_R), x_eps(eps_h, GRAD_EPS_H);
+  const GradientDual x_lambda(lambda, GRAD_LAMBDA);
+  const GradientDual D = diameter(x_L, x_H);
+  const GradientComplex eps = is_silver ? epsAgSD(x_lambda, D, cursor) : epsAuSD(x_lambda, D, cursor);
+  const GradientComplex alpha = dipPolariz(x_lambda, eps, x_eps, x_L, x_H, x_R);
+  const GradientDual k = 2.0*M_PI*sqrt(x_eps)/x_lambda;
+  c_sca = 8.0*M_PI*pow(k, 4)*norm(alpha)*1.0e-14/3.0;
+  c_ext = 4.0*M_PI*k*imag(alpha)*1.0e-14;
+}
+
+
+/***********************************************************************************************************************
+  Parameter sweeps.
+***********************************************************************************************************************/
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Uniform grid of one sweep parameter.
+----------------------------------------------------------------------------------------------------------------------*/
+struct SweepAxis
+{
+  double min, max;                          // Range of values.
+  int n;                                    // Number of values; a single value is min.
+
+  double at(
+    const int &i) const                     // Index of the value.
+  { return (n > 1) ? min + i*(max - min)/(n - 1) : min; }
+};
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Shape coefficients on a regular (L, H, R) grid. Each fitted term is a power of a ratio of two sizes and
+  factorizes, e.g. a1*(L/H)^p1 = [a1*L^p1]*[H^-p1], so the powers are computed once per axis value and a grid
+  node only needs products and sums: O(nL + nH + nR) pow calls instead of 12 per node.
+----------------------------------------------------------------------------------------------------------------------*/
+class ShapeGrid
+{
+public:
+
+  ShapeGrid(
+    const SweepAxis &L,                     // Edge length grid in nm.
+    const SweepAxis &H,                     // Thickness grid in nm.
+    const SweepAxis &R);                    // Triangle base corner radius grid in nm.
+
+  // Shape coefficients beta, eps_c, a2, a4 at a grid node, the same as shapeCoef() up to rounding.
+  void coef(
+    const int &l,                           // Index on the L grid.
+    const int &h,                           // Index on the H grid.
+    const int &r,                           // Index on the R grid.
+    double shape[4]) const;                 // Output: shape coefficients.
+
+  // Model of the prism at a grid node.
+  PrismModel model(
+    const int &l,                           // Index on the L grid.
+    const int &h,                           // Index on the H grid.
+    const int &r) const;                    // Index on the R grid.
+
+private:
+
+  SweepAxis L_, H_, R_;                     // Grids.
+
+  // Factors of the terms of coefficient k at each axis value, stored as [4*i + k]:
+  // L/H term = lh_l*lh_h, L/R term = lr_l*lr_r, H/R term = hr_h*hr_r.
+  std::vector<double> lh_l_, lh_h_, lr_l_, lr_r_, hr_h_, hr_r_;
+};
+
+
+ShapeGrid::ShapeGrid(
+  const SweepAxis &L,                       // Edge length grid in nm.
+  const SweepAxis &H,                       // Thickness grid in nm.
+  const SweepAxis &R)                       // Triangle base corner radius grid in nm.
+  : L_(L), H_(H), R_(R),
+    lh_l_(4*L.n), lh_h_(4*H.n), lr_l_(4*L.n), lr_r_(4*R.n), hr_h_(4*H.n), hr_r_(4*R.n)
+{
+  for (int k = 0; k < 4; ++k) {
+    const ShapeFit &f = shape_fit[k];
+    for (int i = 0; i < L.n; ++i) {
+      lh_l_[4*i + k] = f.a1*pow(L.at(i), f.p1);
+      lr_l_[4*i + k] = f.a2*pow(L.at(i), f.p2);
+    }
+    for (int i = 0; i < H.n; ++i) {
+      lh_h_[4*i + k] = pow(H.at(i), -f.p1);
+      hr_h_[4*i + k] = f.a3*pow(H.at(i), f.p3);
+    }
+    for (int i = 0; i < R.n; ++i) {
+      lr_r_[4*i + k] = pow(R.at(i), -f.p2);
+      hr_r_[4*i + k] = pow(R.at(i), -f.p3);
+    }
+  }
+}
+
+
+inline void ShapeGrid::coef(
+  const int &l,                             // Index on the L grid.
+  const int &h,                             // Index on the H grid.
+  const int &r,                             // Index on the R grid.
+  double shape[4]) const                    // Output: shape coefficients.
+{
+  for (int k = 0; k < 4; ++k)
+    shape[k] = lh_l_[4*l + k]*lh_h_[4*h + k] + lr_l_[4*l + k]*lr_r_[4*r + k] + hr_h_[4*h + k]*hr_r_[4*r + k]
+             + shape_fit[k].a0;
+}
+
+
+inline PrismModel ShapeGrid::model(
+  const int &l,                             // Index on the L grid.
+  const int &h,                             // Index on the H grid.
+  const int &r) const                       // Index on the R grid.
+{
+  double shape[4];
+  coef(l, h, r, shape);
+  return PrismModel(L_.at(l), H_.at(h), R_.at(r), shape);
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Sweep over the cartesian product of the parameter grids, each point giving a spectrum with the size-dependent
+  dielectric function at D = diameter(L, H).
+----------------------------------------------------------------------------------------------------------------------*/
+struct SweepSpec
+{
+  SweepAxis L, H, R;                        // Edge length, thickness and corner radius in nm.
+  SweepAxis eps_h;                          // Dielectric permittivity of host media.
+  bool silver, gold;                        // Materials to include.
+  double wl_min, wl_max, wl_step;           // Wavelength grid in nm.
+  int chunk;                                // Points per work item, 0 - default.
+  int threads;                              // Worker threads, 0 - one per hardware thread.
+  int memory;                               // Megabytes of results between workers and consumer, 0 - default.
+};
+
+
+struct SweepPoint
+{
+  double L, H, R;                           // Geometry in nm.
+  double eps_h;                             // Dielectric permittivity of host media.
+  bool is_silver;                           // Material: true - silver, false - gold.
+};
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Spectrum of one sweep point as passed to the consumer. The arrays are valid only during the call.
+----------------------------------------------------------------------------------------------------------------------*/
+struct SweepResult
+{
+  long long index;                          // Index of the point in the sweep.
+  SweepPoint point;                         // Parameters of the point.
+  int n;                                    // Number of wavelength points.
+  const double *lambda;                     // Wavelengths in nm.
+  const double *alpha_re, *alpha_im;        // Polarizability in nm^3.
+  const double *c_sca, *c_ext, *c_abs;      // Cross sections in cm^2.
+};
+
+typedef std::function<void(const SweepResult &)> SweepSink;
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Multithreaded sweep engine. The points are split into chunks which worker threads take from their own ranges
+  and steal from the ranges of others when theirs run out; a worker with nothing left takes the next block of
+  chunks not yet given out. Results go to a ring of slots, one per chunk of a window that starts at the next chunk
+  of the consumer, and the calling thread hands each chunk to the consumer as soon as it and all before it are
+  complete, strictly in the order of point indices, so the output does not depend on the number of threads.
+  The window holds SweepSpec::memory megabytes of results, 64 by default, and no chunk beyond it is started: memory
+  is bounded while the workers never wait for each other, only for the consumer when it falls a window behind.
+----------------------------------------------------------------------------------------------------------------------*/
+class SweepEngine
+{
+public:
+
+  SweepEngine(
+    const SweepSpec &spec);                 // Sweep parameters.
+
+  // Number of points in the sweep.
+  long long size() const;
+
+  // Parameters of a point.
+  SweepPoint point(
+    const long long &index) const;          // Index of the point in the sweep.
+
+  // Spectrum of a point: 5 arrays of wavelengths() values (alpha_re, alpha_im, c_sca, c_ext, c_abs) one after
+  // another in out; scratch is reused between calls.
+  void evaluate(
+    const SweepPoint &p,                    // Parameters of the point.
+    double out[],                           // Output: spectrum.
+    std::vector<double> &scratch) const;    // Work array.
+
+  // Spectrum of the point with the given index, with the shape coefficients taken from the sweep grid.
+  void evaluate(
+    const long long &index,                 // Index of the point in the sweep.
+    double out[],                           // Output: spectrum.
+    std::vector<double> &scratch) const;    // Work array.
+
+  // Evaluates all points and passes them to sink in index order. An exception of a worker or of sink stops the
+  // workers and is rethrown.
+  void run(
+    const SweepSink &sink) const;           // Consumer of the results.
+
+  int wavelengths() const { return (int)lambda_.size(); }
+  const double *lambda() const { return lambda_.data(); }
+
+  // Wavelength grid of a sweep.
+  static std::vector<double> grid(
+    const SweepSpec &spec);                 // Sweep parameters.
+
+private:
+
+  SweepSpec spec_;                          // Sweep parameters.
+  std::vector<double> lambda_;              // Wavelength grid in nm.
+  std::vector<bool> materials_;             // Materials of the sweep, is_silver.
+  std::vector<DielectricCache> eps_;        // Bulk permittivity of each material on the grid.
+  ShapeGrid shape_;                         // Shape coefficients on the (L, H, R) grid.
+
+  // Grid indices of a point.
+  void indices(
+    const long long &index,                 // Index of the point in the sweep.
+    int idx[5]) const;                      // Output: indices of material, eps_h, L, H, R.
+
+  // Spectrum of the prism at a point.
+  void evaluate(
+    const PrismModel &prism,                // Prism model.
+    const SweepPoint &p,                    // Parameters of the point.
+    double out[],                           // Output: spectrum.
+    std::vector<double> &scratch) const;    // Work array.
+};
+
+
+SweepEngine::SweepEngine(
+  const SweepSpec &spec)                    // Sweep parameters.
+  : spec_(spec), lambda_(grid(spec)), shape_(spec.L, spec.H, spec.R)
+{
+  const int wl_n = (int)lambda_.size();
+
+  if (spec.silver) materials_.push_back(true);
+  if (spec.gold) materials_.push_back(false);
+  for (size_t m = 0; m < materials_.size(); ++m)
+    eps_.push_back(DielectricCache(materials_[m], wl_n, lambda_.data()));
+}
+
+
+std::vector<double> SweepEngine::grid(
+  const SweepSpec &spec)                    // Sweep parameters.
+{
+  int wl_n = (int)((spec.wl_max - spec.wl_min)/spec.wl_step) + 1;
+  std::vector<double> wl(wl_n);
+  for (int i = 0; i < wl_n; ++i)
+    wl[i] = spec.wl_min + i*spec.wl_step;
+  return wl;
+}
+
+
+long long SweepEngine::size() const
+{
+  return (long long)materials_.size()*spec_.eps_h.n*spec_.L.n*spec_.H.n*spec_.R.n;
+}
+
+
+void SweepEngine::indices(
+  const long long &index,                   // Index of the point in the sweep.
+  int idx[5]) const                         // Output: indices of material, eps_h, L, H, R.
+{
+  long long k = index;
+  idx[4] = (int)(k % spec_.R.n);      k /= spec_.R.n;
+  idx[3] = (int)(k % spec_.H.n);      k /= spec_.H.n;
+  idx[2] = (int)(k % spec_.L.n);      k /= spec_.L.n;
+  idx[1] = (int)(k % spec_.eps_h.n);  k /= spec_.eps_h.n;
+  idx[0] = (int)k;
+}
+
+
+SweepPoint SweepEngine::point(
+  const long long &index) const             // Index of the point in the sweep.
+{
+  int idx[5];
+  indices(index, idx);
+  SweepPoint p;
+  p.is_silver = materials_[idx[0]];
+  p.eps_h = spec_.eps_h.at(idx[1]);
+  p.L = spec_.L.at(idx[2]);
+  p.H = spec_.H.at(idx[3]);
+  p.R = spec_.R.at(idx[4]);
+  return p;
+}
+
+
+void SweepEngine::evaluate(
+  const PrismModel &prism,                  // Prism model.
+  const SweepPoint &p,                      // Parameters of the point.
+  double out[],                             // Output: spectrum.
+  std::vector<double> &scratch) const       // Work array.
+{
+  const int n = wavelengths();
+  const DielectricCache &eps = eps_[(p.is_silver == materials_[0]) ? 0 : 1];
+  scratch.resize(2*n);
+  double D = diameter(p.L, p.H);
+  eps.sizeDependentBatch(1, &D, scratch.data(), scratch.data() + n);
+
+  prism.spectrumBatch(n, lambda_.data(), scratch.data(), scratch.data() + n, p.eps_h,
+                      out, out + n, out + 2*n, out + 3*n, out + 4*n);
+}
+
+
+void SweepEngine::evaluate(
+  const SweepPoint &p,                      // Parameters of the point.
+  double out[],                             // Output: spectrum.
+  std::vector<double> &scratch) const       // Work array.
+{
+  evaluate(PrismModel(p.L, p.H, p.R), p, out, scratch);
+}
+
+
+void SweepEngine::evaluate(
+  const long long &index,                   // Index of the point in the sweep.
+  double out[],                             // Output: spectrum.
+  std::vector<double> &scratch) const       // Work array.
+{
+  int idx[5];
+  indices(index, idx);
+  evaluate(shape_.model(idx[2], idx[3], idx[4]), point(index), out, scratch);
+}
+
+
+void SweepEngine::run(
+  const SweepSink &sink) const              // Consumer of the results.
+{
+  const long long total = size();
+  const int n = wavelengths();
+  const int rec = 5*n;
+  const long long chunk = (spec_.chunk > 0) ? spec_.chunk : 64;
+  const long long num_chunks = (total + chunk - 1)/chunk;
+  int threads = (spec_.threads > 0) ? spec_.threads : (int)std::thread::hardware_concurrency();
+  if (threads < 1) threads = 1;
+
+  // Window of budget/(5*n*8) points in whole chunks, and the block of it a worker takes at a time, small enough
+  // for the workers to keep busy while the consumer frees the oldest chunks.
+  const double budget = ((spec_.memory > 0) ? spec_.memory : 64)*1048576.0;
+  const long long window = std::max(std::min((long long)(budget/(8.0*rec))/chunk, num_chunks), 1LL);
+  const long long block = std::max(window/(2LL*threads), 1LL);
+
+  // Range of chunks owned by a worker and its scratch space.
+  struct Worker
+  {
+    std::mutex m;
+    long long begin, end;
+    std::vector<double> scratch;
+  };
+  std::vector<Worker> workers(threads);
+  for (int t = 0; t < threads; ++t) workers[t].begin = workers[t].end = 0;
+
+  // Chunk c goes to slot c % window.
+  std::vector<double> slots((size_t)window*chunk*rec);
+  std::vector<char> ready(window, 0);
+
+  std::mutex sync;                          // Guards ready, issued, merged and waiting.
+  std::condition_variable done_cv, space_cv;
+  long long issued = 0;                     // Chunks given out to the workers.
+  long long merged = 0;                     // Chunks handed to the consumer.
+  int waiting = 0;                          // Workers waiting for the window to move.
+  std::atomic<bool> stop(false);            // Set on an error or when the consumer is done.
+  std::exception_ptr error;                 // First exception of a worker, rethrown by run().
+
+  // Next chunk for worker t: from its own range, otherwise half of the range of another worker, otherwise the
+  // next block within the window, waiting for the consumer if the window is full.
+  auto take = [&](const int &t, long long &c) -> bool {
+    for (;;) {
+      if (stop) return false;
+      {
+        std::lock_guard<std::mutex> lk(workers[t].m);
+        if (workers[t].begin < workers[t].end) {
+          c = workers[t].begin++;
+          return true;
+        }
+      }
+      for (int k = 1; k < threads; ++k) {
+        Worker &v = workers[(t + k) % threads];
+        long long b, e;
+        {
+          std::lock_guard<std::mutex> lk(v.m);
+          if (v.begin >= v.end) continue;
+          b = v.begin + (v.end - v.begin)/2;
+          e = v.end;
+          v.end = b;
+          if (b == e) {
+            c = v.begin++;
+            return true;
+          }
+        }
+        std::lock_guard<std::mutex> lk(workers[t].m);
+        c = b;
+        workers[t].begin = b + 1;
+        workers[t].end = e;
+        return true;
+      }
+
+      long long b, e;
+      {
+        std::unique_lock<std::mutex> lk(sync);
+        if (issued == num_chunks) return false;
+        if (issued >= merged + window) {
+          ++waiting;
+          space_cv.wait(lk, [&] { return stop || (issued < merged + window); });
+          --waiting;
+          continue;                         // Stealing may have become possible meanwhile.
+        }
+        b = issued;
+        e = std::min(std::min(b + block, merged + window), num_chunks);
+        issued = e;
+      }
+      std::lock_guard<std::mutex> lk(workers[t].m);
+      c = b;
+      workers[t].begin = b + 1;
+      workers[t].end = e;
+      return true;
+    }
+  };
+
+  auto work = [&](const int t) {
+    try {
+      long long c;
+      while (take(t, c)) {
+        long long first = c*chunk;
+        long long last = std::min(first + chunk, total);
+        double *out = slots.data() + (size_t)(c % window)*chunk*rec;
+        for (long long i = first; i < last; ++i)
+          evaluate(i, out + (size_t)(i - first)*rec, workers[t].scratch);
+        bool next;
+        {
+          std::lock_guard<std::mutex> lk(sync);
+          ready[c % window] = 1;
+          next = c == merged;
+        }
+        if (next) done_cv.notify_one();
+      }
+    } catch (...) {
+      {
+        std::lock_guard<std::mutex> lk(sync);
+        if (!error) error = std::current_exception();
+        stop = true;
+      }
+      done_cv.notify_one();
+      space_cv.notify_all();
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (int t = 0; t < threads; ++t)
+    pool.push_back(std::thread(work, t));
+
+  auto finish = [&]() {
+    {
+      std::lock_guard<std::mutex> lk(sync);
+      stop = true;
+    }
+    space_cv.notify_all();
+    for (size_t t = 0; t < pool.size(); ++t) pool[t].join();
+  };
+
+  try {
+    SweepResult r;
+    r.n = n;
+    r.lambda = lambda_.data();
+    for (long long c = 0; c < num_chunks; ++c) {
+      {
+        std::unique_lock<std::mutex> lk(sync);
+        done_cv.wait(lk, [&] { return stop || (ready[c % window] != 0); });
+      }
+      if (stop) break;                      // A worker has failed.
+      const double *data = slots.data() + (size_t)(c % window)*chunk*rec;
+      long long first = c*chunk;
+      long long last = std::min(first + chunk, total);
+      for (long long i = first; i < last; ++i, data += rec) {
+        r.index = i;
+        r.point = point(i);
+        r.alpha_re = data;
+        r.alpha_im = data + n;
+        r.c_sca = data + 2*n;
+        r.c_ext = data + 3*n;
+        r.c_abs = data + 4*n;
+        sink(r);
+      }
+      bool wake;
+      {
+        std::lock_guard<std::mutex> lk(sync);
+        ready[c % window] = 0;
+        merged = c + 1;
+        wake = waiting > 0;
+      }
+      if (wake) space_cv.notify_all();
+    }
+  } catch (...) {
+    finish();
+    throw;
+  }
+  finish();
+  if (error) std::rethrow_exception(error);
+}
+
+
+/***********************************************************************************************************************
+  Plasmon resonance.
+
+  The polarizability is alpha = pref/d(lambda) with d = 1/(eps_m/eps_h - 1) - 1/(eps_c - 1) - Arc, so the resonance
+  is the zero of Re d. Since Re d = pref*Re(alpha)/|alpha|^2 with pref > 0, the function g = Re(alpha)/|alpha|^2
+  has the same zeros and is evaluated from the polarizability. Near the zero alpha is a Lorentzian in lambda, and
+  its full width at half maximum is 2|Im d|/|d'(Re d)/d lambda|.
+
+  The plasmon zero is the last one on the way to longer wavelengths where g changes from negative to positive
+  (zeros at shorter wavelengths come from interband transitions). The search starts from a quasi-static guess,
+  which takes the shape coefficients of the prism and a Drude fit of the bulk permittivity and costs no
+  evaluation. Steps growing from the guess bracket the zero, usually in one or two evaluations, and Brent's method
+  refines it. If the steps reach the end of the range with g still moving towards zero, the resonance lies beyond
+  the range and its end is returned without a zero. Otherwise g is taken on a coarse grid: a bracket found there
+  is refined as well, and if g stays negative, because of strong damping or a close pair of zeros between the
+  grid points, its maximum is found instead. The pair of zeros is then recovered, and otherwise the maximum,
+  where |alpha| peaks, is taken as the resonance.
+***********************************************************************************************************************/
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Resonance of a particle.
+----------------------------------------------------------------------------------------------------------------------*/
+struct Resonance
+{
+  double lambda;                            // Resonance wavelength in nm.
+  double c_sca, c_ext, c_abs;               // Cross sections at the resonance in cm^2.
+  double fwhm;                              // Full width at half maximum in nm, NaN without a zero of Re d.
+  bool crossing;                            // Re d vanishes at lambda; otherwise lambda is its maximum.
+  int evaluations;                          // Number of evaluations of the polarizability, all of the search.
+};
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Polarizability of one particle at arbitrary wavelengths, keeping the position in the dielectric table.
+----------------------------------------------------------------------------------------------------------------------*/
+class ResonanceProbe
+{
+public:
+
+  ResonanceProbe(
+    const PrismModel &prism,                // Prism model.
+    const bool &is_silver,                  // Material: true - silver, false - gold.
+    const double &eps_h)                    // Dielectric permittivity of host media.
+    : prism_(prism), is_silver_(is_silver), eps_h_(eps_h), D_(diameter(prism.edge(), prism.thickness())),
+      count_(0) {}
+
+  // Polarizability in nm^3.
+  std::complex<double> alpha(
+    const double &lambda)                   // Wavelength in nm.
+  {
+    ++count_;
+    std::complex<double> eps = is_silver_ ? epsAgSD(lambda, D_, cursor_) : epsAuSD(lambda, D_, cursor_);
+    return prism_.polariz(lambda, eps, eps_h_);
+  }
+
+  // Polarizability and all cross sections.
+  void crossSections(
+    const double &lambda,                   // Wavelength in nm.
+    std::complex<double> &alpha,            // Output: polarizability in nm^3.
+    double &c_sca,                          // Output: scattering cross section in cm^2.
+    double &c_ext,                          // Output: extinction cross section in cm^2.
+    double &c_abs)                          // Output: absorption cross section in cm^2.
+  {
+    ++count_;
+    std::complex<double> eps = is_silver_ ? epsAgSD(lambda, D_, cursor_) : epsAuSD(lambda, D_, cursor_);
+    prism_.crossSections(lambda, eps, eps_h_, alpha, c_sca, c_ext, c_abs);
+  }
+
+  // Re(alpha)/|alpha|^2, proportional to the real part of the denominator.
+  double g(
+    const double &lambda)                   // Wavelength in nm.
+  {
+    std::complex<double> a = alpha(lambda);
+    return std::real(a)/std::norm(a);
+  }
+
+  int count() const { return count_; }
+
+private:
+
+  const PrismModel &prism_;                 // Prism model.
+  bool is_silver_;                          // Material.
+  double eps_h_;                            // Host media.
+  double D_;                                // Size parameter of the dielectric function.
+  TableCursor cursor_;                      // Position in the dielectric table.
+  int count_;                               // Number of evaluations.
+};
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Zero of f in [a, b] with f(a) < 0 < f(b) by Brent's method (inverse quadratic interpolation safeguarded by
+  bisection).
+----------------------------------------------------------------------------------------------------------------------*/
+template <typename F>
+double brentZero(
+  F &f,                                     // Function.
+  double a,                                 // Ends of the bracket ...
+  double b,                                 // ...
+  double fa,                                // ... and the values there.
+  double fb,                                // ...
+  const double &tol)                        // Absolute tolerance in the argument.
+{
+  double c = a, fc = fa, d = b - a, e = d;
+  for (int iter = 0; iter < 60; ++iter) {
+    if ((fb > 0.0) == (fc > 0.0)) {
+      c = a;
+      fc = fa;
+      d = e = b - a;
+    }
+    if (fabs(fc) < fabs(fb)) {
+      a = b;  b = c;  c = a;
+      fa = fb;  fb = fc;  fc = fa;
+    }
+    double tol1 = 2.0*DBL_EPSILON*fabs(b) + 0.5*tol;
+    double xm = 0.5*(c - b);
+    if ((fabs(xm) <= tol1) || (fb == 0.0)) return b;
+
+    if ((fabs(e) >= tol1) && (fabs(fa) > fabs(fb))) {
+      double s = fb/fa, p, q;
+      if (a == c) {
+        p = 2.0*xm*s;
+        q = 1.0 - s;
+      } else {
+        double qa = fa/fc, r = fb/fc;
+        p = s*(2.0*xm*qa*(qa - r) - (b - a)*(r - 1.0));
+        q = (qa - 1.0)*(r - 1.0)*(s - 1.0);
+      }
+      if (p > 0.0) q = -q;
+      p = fabs(p);
+      if (2.0*p < std::min(3.0*xm*q - fabs(tol1*q), fabs(e*q))) {
+        e = d;
+        d = p/q;
+      } else {
+        d = xm;
+        e = d;
+      }
+    } else {
+      d = xm;
+      e = d;
+    }
+    a = b;
+    fa = fb;
+    b += (fabs(d) > tol1) ? d : ((xm > 0.0) ? tol1 : -tol1);
+    fb = f(b);
+  }
+  return b;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Cross sections at the resonance wavelength found, the width from the slope of Re d there and the count of
+  evaluations. g at the resonance comes with the cross sections, so the slope takes one more evaluation.
+----------------------------------------------------------------------------------------------------------------------*/
+void completeResonance(
+  ResonanceProbe &probe,                    // Polarizability of the particle.
+  Resonance &res)                           // Resonance with lambda and crossing set, completed.
+{
+  std::complex<double> alpha;
+  probe.crossSections(res.lambda, alpha, res.c_sca, res.c_ext, res.c_abs);
+  res.fwhm = NAN;
+  if (res.crossing) {
+    const double h = 0.02;
+    double slope = (probe.g(res.lambda + h) - std::real(alpha)/std::norm(alpha))/h;
+    res.fwhm = 2.0*fabs(std::imag(alpha)/std::norm(alpha)/slope);
+  }
+  res.evaluations = probe.count();
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Resonance from the values of g on a coarse grid, refined with the probe.
+----------------------------------------------------------------------------------------------------------------------*/
+Resonance refineResonance(
+  ResonanceProbe &probe,                    // Polarizability of the particle.
+  const int &n,                             // Number of coarse grid points, at least 3.
+  const double lambda[],                    // Coarse grid in nm, increasing.
+  const double g[],                         // g on the coarse grid.
+  const double &tol)                        // Tolerance of the resonance wavelength in nm.
+{
+  auto f = [&](const double &x) { return probe.g(x); };
+  Resonance res;
+  res.crossing = false;
+
+  int k = -1;                               // Last bracket of a rising zero.
+  for (int i = n - 2; i >= 0; --i)
+    if ((g[i] <= 0.0) && (g[i + 1] > 0.0)) {
+      k = i;
+      break;
+    }
+
+  double a = 0.0, b = 0.0, fa = 0.0, fb = 0.0;
+  if (k >= 0) {
+    a = lambda[k];  fa = g[k];
+    b = lambda[k + 1];  fb = g[k + 1];
+    res.crossing = true;
+  } else {
+    // Maximum of g by golden section around the largest grid value.
+    int j = (int)(std::max_element(g, g + n) - g);
+    double lo = lambda[std::max(j - 1, 0)], hi = lambda[std::min(j + 1, n - 1)];
+    const double r = 0.5*(3.0 - std::sqrt(5.0));
+    double x1 = lo + r*(hi - lo), x2 = hi - r*(hi - lo);
+    double f1 = f(x1), f2 = f(x2);
+    while ((hi - lo > 10.0*tol) && (std::max(f1, f2) <= 0.0)) {
+      if (f1 > f2) {
+        hi = x2;  x2 = x1;  f2 = f1;
+        x1 = lo + r*(hi - lo);
+        f1 = f(x1);
+      } else {
+        lo = x1;  x1 = x2;  f1 = f2;
+        x2 = hi - r*(hi - lo);
+        f2 = f(x2);
+      }
+    }
+    double x_max = (f1 > f2) ? x1 : x2, f_max = std::max(f1, f2);
+    if ((f_max > 0.0) && (j > 0)) {       // A pair of zeros: the rising one is below the maximum.
+      a = lambda[j - 1];  fa = g[j - 1];
+      b = x_max;  fb = f_max;
+      res.crossing = fa <= 0.0;
+    }
+    if (!res.crossing) res.lambda = x_max;
+  }
+  if (res.crossing) res.lambda = brentZero(f, a, b, fa, fb, tol);
+  completeResonance(probe, res);
+  return res;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Drude form eps_re = eps_inf - b*lambda^2 of the real part of the bulk permittivity of a material, fitted by least
+  squares between 450 and 1000 nm on first use.
+----------------------------------------------------------------------------------------------------------------------*/
+struct DrudeSeed
+{
+  double eps_inf;                           // Permittivity at high frequency.
+  double b;                                 // (omega_p/1239.8)^2 in nm^-2.
+};
+
+
+const DrudeSeed &drudeSeed(
+  const bool &is_silver)                    // Material: true - silver, false - gold.
+{
+  auto fit = [](const bool &ag) {
+    double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+    int n = 0;
+    for (double lambda = 450.0; lambda <= 1000.0; lambda += 10.0, ++n) {
+      double x = lambda*lambda, y = std::real(ag ? epsAg(lambda) : epsAu(lambda));
+      sx += x;  sy += y;  sxx += x*x;  sxy += x*y;
+    }
+    DrudeSeed d;
+    d.b = -(n*sxy - sx*sy)/(n*sxx - sx*sx);
+    d.eps_inf = (sy + d.b*sx)/n;
+    return d;
+  };
+  static const DrudeSeed seed[2] = {fit(true), fit(false)};
+  return seed[is_silver ? 0 : 1];
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Quasi-static guess of the resonance: the zero of Re d with Im(eps_m) neglected,
+    eps_re(lambda) = eps_h*(1 + 1/(1/(eps_c - 1) + s^2*(a2 + a4*s^2))),  s = sqrt(eps_h)*L/lambda,
+  with eps_re from drudeSeed(), solved by fixed-point iteration on lambda. Clamped to the search range.
+----------------------------------------------------------------------------------------------------------------------*/
+double resonanceGuess(
+  const PrismModel &prism,                  // Prism model.
+  const bool &is_silver,                    // Material: true - silver, false - gold.
+  const double &eps_h,                      // Dielectric permittivity of host media.
+  const double &lambda_min,                 // Search range in nm.
+  const double &lambda_max)                 // ...
+{
+  const PolarizCoef c = prism.coef(eps_h);
+  const DrudeSeed &m = drudeSeed(is_silver);
+  double x = 0.5*(lambda_min + lambda_max);
+  for (int iter = 0; iter < 8; ++iter) {
+    double s2 = c.sL*c.sL/(x*x);
+    double x2 = (m.eps_inf - eps_h*(1.0 + 1.0/(c.inv_ec1 + s2*(c.a2 + s2*c.a4))))/m.b;
+    if (!(x2 > 0.0)) break;
+    x = std::sqrt(x2);
+  }
+  return std::min(std::max(x, lambda_min), lambda_max);
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Coarse grid of the fallback search: steps of about 50 nm, at least 3 points.
+----------------------------------------------------------------------------------------------------------------------*/
+std::vector<double> resonanceGrid(
+  const double &lambda_min,                 // Search range in nm.
+  const double &lambda_max)                 // ...
+{
+  int n = std::max((int)ceil((lambda_max - lambda_min)/50.0), 2) + 1;
+  std::vector<double> grid(n);
+  for (int i = 0; i < n; ++i) grid[i] = lambda_min + i*(lambda_max - lambda_min)/(n - 1);
+  return grid;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Plasmon resonance of a prism in the given wavelength range.
+----------------------------------------------------------------------------------------------------------------------*/
+Resonance findResonance(
+  const PrismModel &prism,                  // Prism model.
+  const bool &is_silver,                    // Material: true - silver, false - gold.
+  const double &eps_h,                      // Dielectric permittivity of host media.
+  const double &lambda_min,                 // Search range in nm.
+  const double &lambda_max,                 // ...
+  const double &tol = 1.0e-3)               // Tolerance of the resonance wavelength in nm.
+{
+  ResonanceProbe probe(prism, is_silver, eps_h);
+  auto f = [&](const double &x) { return probe.g(x); };
+
+  // From the guess up while g <= 0, down while g > 0, doubling the step, until the sign changes. Where g turns
+  // away from zero, the vertex of the parabola through the last three points is tried for a dip across it.
+  double x = resonanceGuess(prism, is_silver, eps_h, lambda_min, lambda_max), fx = f(x);
+  const bool up = !(fx > 0.0);
+  int steps = 0;
+  double x_prev = x, f_prev = fx;
+  for (double h = 0.02*x; up ? (x < lambda_max) : (x > lambda_min); h *= 2.0, ++steps) {
+    double y = up ? std::min(x + h, lambda_max) : std::max(x - h, lambda_min), fy = f(y);
+    double a = x, b = y, fa = fx, fb = fy;  // Bracket if the sign changes between a and b.
+    if (((fy > 0.0) != up) && (steps > 0) && (up ? (fy < fx) : (fy > fx))) {
+      double d1 = (fx - f_prev)/(x - x_prev), d2 = (fy - fx)/(y - x), c = (d2 - d1)/(y - x_prev);
+      double v = 0.5*(x_prev + x) - d1/(2.0*c);
+      if (std::isfinite(v) && (std::min(y, x_prev) < v) && (v < std::max(y, x_prev)) && (v != x)) {
+        double fv = f(v);
+        a = ((v < x) == up) ? x_prev : x;
+        fa = ((v < x) == up) ? f_prev : fx;
+        b = v;
+        fb = fv;
+      }
+    }
+    if ((fb > 0.0) == up) {
+      Resonance res;
+      res.crossing = true;
+      res.lambda = (a < b) ? brentZero(f, a, b, fa, fb, tol) : brentZero(f, b, a, fb, fa, tol);
+      completeResonance(probe, res);
+      return res;
+    }
+    x_prev = x;
+    f_prev = fx;
+    x = y;
+    fx = fy;
+  }
+
+  // g still moving towards zero at the end of the range: the resonance is beyond it, and the end is taken.
+  if (steps == 0) f_prev = f(up ? x - 0.02*x : x + 0.02*x);  // The guess was at the end.
+  if (up ? (fx > f_prev) : (fx < f_prev)) {
+    Resonance res;
+    res.crossing = false;
+    res.lambda = x;
+    completeResonance(probe, res);
+    return res;
+  }
+
+  const std::vector<double> grid = resonanceGrid(lambda_min, lambda_max);
+  std::vector<double> g(grid.size());
+  for (size_t i = 0; i < grid.size(); ++i) g[i] = f(grid[i]);
+  return refineResonance(probe, (int)grid.size(), grid.data(), g.data(), tol);
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Plasmon resonances of many prisms, split between threads.
+----------------------------------------------------------------------------------------------------------------------*/
+void resonanceBatch(
+  const int &n,                             // Number of particles.
+  const SweepPoint points[],                // Particles.
+  const double &lambda_min,                 // Search range in nm.
+  const double &lambda_max,                 // ...
+  Resonance res[],                          // Output: resonances.
+  const int &threads = 1,                   // Number of threads, 0 - one per hardware thread.
+  const double &tol = 1.0e-3)               // Tolerance of the resonance wavelength in nm.
+{
+  auto work = [&](const int &first, const int &last) {
+    for (int k = first; k < last; ++k) {
+      const SweepPoint &p = points[k];
+      res[k] = findResonance(PrismModel(p.L, p.H, p.R), p.is_silver, p.eps_h, lambda_min, lambda_max, tol);
+    }
+  };
+
+  int num = (threads > 0) ? threads : (int)std::thread::hardware_concurrency();
+  num = std::max(std::min(num, n/64), 1);
+  if (num == 1) {
+    work(0, n);
+    return;
+  }
+  std::vector<std::thread> pool;
+  for (int t = 0; t < num; ++t)
+    pool.push_back(std::thread(work, (int)((long long)n*t/num), (int)((long long)n*(t + 1)/num)));
+  for (int t = 0; t < num; ++t) pool[t].join();
+}
+
+
+/***********************************************************************************************************************
+  Adaptive wavelength sampling.
+
+  A uniform grid spends most of its points on the flat tails of the spectrum and can still under-resolve a narrow
+  resonance. The adaptive spectrum starts from the coarse grid of the resonance search with the plasmon resonance
+  added to it, and bisects every interval whose midpoint differs from the linear interpolation between its ends,
+  in C_ext or C_sca, by more than a tolerance relative to the maximum of that cross section. The midpoints of
+  accepted intervals are kept too, so the interpolation error of the result is well below the tolerance. Finally
+  the extinction maximum itself is located by parabolic steps and added, so the peak is exact to the sampling.
+***********************************************************************************************************************/
+
+const double adaptive_min_step = 0.01;      // Shortest interval of adaptive sampling in nm.
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Spectrum on a non-uniform wavelength grid.
+----------------------------------------------------------------------------------------------------------------------*/
+struct AdaptiveSpectrum
+{
+  std::vector<double> lambda;               // Wavelengths in nm, increasing.
+  std::vector<double> alpha_re, alpha_im;   // Polarizability in nm^3.
+  std::vector<double> c_sca, c_ext, c_abs;  // Cross sections in cm^2.
+  int evaluations;                          // Number of evaluations of the polarizability.
+};
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Spectrum of a prism sampled adaptively in the given wavelength range.
+----------------------------------------------------------------------------------------------------------------------*/
+AdaptiveSpectrum adaptiveSpectrum(
+  const PrismModel &prism,                  // Prism model.
+  const bool &is_silver,                    // Material: true - silver, false - gold.
+  const double &eps_h,                      // Dielectric permittivity of host media.
+  const double &lambda_min,                 // Wavelength range in nm.
+  const double &lambda_max,                 // ...
+  const double &tol = 1.0e-3)               // Tolerance of the interpolation relative to the maximum.
+{
+  struct Sample
+  {
+    double lambda;                          // Wavelength in nm.
+    std::complex<double> alpha;             // Polarizability in nm^3.
+    double c_sca, c_ext, c_abs;             // Cross sections in cm^2.
+  };
+
+  ResonanceProbe probe(prism, is_silver, eps_h);
+  std::vector<Sample> samples;
+  double sca_max = 0.0, ext_max = 0.0;      // Scales of the tolerance.
+  auto sample = [&](const double &x) {
+    Sample p;
+    p.lambda = x;
+    probe.crossSections(x, p.alpha, p.c_sca, p.c_ext, p.c_abs);
+    sca_max = std::max(sca_max, fabs(p.c_sca));
+    ext_max = std::max(ext_max, fabs(p.c_ext));
+    samples.push_back(p);
+    return p;
+  };
+
+  // Coarse grid, and the resonance found from it.
+  const std::vector<double> grid = resonanceGrid(lambda_min, lambda_max);
+  const int m = (int)grid.size();
+  std::vector<double> g(m);
+  for (int i = 0; i < m; ++i) {
+    Sample p = sample(grid[i]);
+    g[i] = std::real(p.alpha)/std::norm(p.alpha);
+  }
+  Resonance res = refineResonance(probe, m, grid.data(), g.data(), adaptive_min_step);
+  int k = (int)(std::upper_bound(grid.begin(), grid.end(), res.lambda) - grid.begin());
+  if ((k > 0) && (k < m) && (res.lambda - grid[k - 1] > adaptive_min_step)
+      && (grid[k] - res.lambda > adaptive_min_step)) {
+    Sample p = sample(res.lambda);
+    samples.pop_back();
+    samples.insert(samples.begin() + k, p);
+  }
+
+  // Bisection of the intervals.
+  std::vector<std::pair<Sample, Sample> > stack;
+  for (size_t i = samples.size() - 1; i > 0; --i) stack.push_back(std::make_pair(samples[i - 1], samples[i]));
+  while (!stack.empty()) {
+    const Sample a = stack.back().first, b = stack.back().second;
+    stack.pop_back();
+    if (b.lambda - a.lambda < 2.0*adaptive_min_step) continue;
+    const Sample c = sample(0.5*(a.lambda + b.lambda));
+    double err = std::max(fabs(c.c_ext - 0.5*(a.c_ext + b.c_ext))/ext_max,
+                          fabs(c.c_sca - 0.5*(a.c_sca + b.c_sca))/sca_max);
+    if (err > tol) {
+      stack.push_back(std::make_pair(c, b));
+      stack.push_back(std::make_pair(a, c));
+    }
+  }
+  auto less = [](const Sample &a, const Sample &b) { return a.lambda < b.lambda; };
+  std::sort(samples.begin(), samples.end(), less);
+
+  // The extinction maximum, which is close to but not at the zero of Re d, by successive parabolic steps.
+  for (int iter = 0; iter < 8; ++iter) {
+    size_t j = 0;
+    for (size_t i = 1; i < samples.size(); ++i)
+      if (samples[i].c_ext > samples[j].c_ext) j = i;
+    if ((j == 0) || (j + 1 == samples.size())) break;
+    const Sample &a = samples[j - 1], &b = samples[j], &c = samples[j + 1];
+    double p = (b.lambda - a.lambda)*(b.c_ext - c.c_ext), q = (b.lambda - c.lambda)*(b.c_ext - a.c_ext);
+    if (p == q) break;
+    double x = b.lambda - 0.5*((b.lambda - a.lambda)*p - (b.lambda - c.lambda)*q)/(p - q);
+    if ((fabs(x - b.lambda) < adaptive_min_step) || (x - a.lambda < adaptive_min_step)
+        || (c.lambda - x < adaptive_min_step))
+      break;
+    Sample d = sample(x);
+    samples.pop_back();
+    samples.insert(std::upper_bound(samples.begin(), samples.end(), d, less), d);
+  }
+
+  AdaptiveSpectrum out;
+  const size_t n = samples.size();
+  out.lambda.resize(n);
+  out.alpha_re.resize(n);
+  out.alpha_im.resize(n);
+  out.c_sca.resize(n);
+  out.c_ext.resize(n);
+  out.c_abs.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    out.lambda[i] = samples[i].lambda;
+    out.alpha_re[i] = std::real(samples[i].alpha);
+    out.alpha_im[i] = std::imag(samples[i].alpha);
+    out.c_sca[i] = samples[i].c_sca;
+    out.c_ext[i] = samples[i].c_ext;
+    out.c_abs[i] = samples[i].c_abs;
+  }
+  out.evaluations = probe.count();
+  return out;
+}
+
+
+/***********************************************************************************************************************
+  Fitting of measured extinction spectra.
+
+  A measured spectrum y(lambda) of a colloid is fitted by scale*C_ext(lambda; L, H, R, eps_h) with the
+  Levenberg-Marquardt method. The scale is the number concentration times the path length, or whatever converts
+  cm^2 to the units of y. The fitted variables are the logarithms of the parameters, which keeps them positive and
+  makes the steps relative. The Jacobian is analytic. The power-law shape fits, the prefactor and the radiative
+  term of the polarizability, the size correction of the permittivity through D(L, H) and the host medium are
+  differentiated in closed form, over the whole wavelength grid in one pass with the bulk permittivity cached.
+***********************************************************************************************************************/
+
+enum FitParam { FIT_L, FIT_H, FIT_R, FIT_EPS_H, FIT_SCALE, FIT_PARAMS };
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Result of a fit.
+----------------------------------------------------------------------------------------------------------------------*/
+struct FitResult
+{
+  double p[FIT_PARAMS];                     // L, H, R in nm, eps_h and scale, in the order of FitParam.
+  double rms;                               // Root mean square residual in the units of the spectrum.
+  int iterations;                           // Number of accepted steps.
+  bool converged;                           // The residual stopped decreasing before the iteration limit.
+};
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Solves A x = b for a symmetric positive definite matrix by the Cholesky decomposition, in place: A is
+  overwritten by the factor and b by the solution. Returns false if A is not positive definite.
+----------------------------------------------------------------------------------------------------------------------*/
+bool choleskySolve(
+  const int &n,                             // Size of the system.
+  double A[],                               // Matrix, n*n, row-major.
+  double b[])                               // Right-hand side, replaced by the solution.
+{
+  for (int j = 0; j < n; ++j) {
+    double d = A[j*n + j];
+    for (int k = 0; k < j; ++k) d -= A[j*n + k]*A[j*n + k];
+    if (!(d > 0.0)) return false;
+    A[j*n + j] = std::sqrt(d);
+    for (int i = j + 1; i < n; ++i) {
+      double s = A[i*n + j];
+      for (int k = 0; k < j; ++k) s -= A[i*n + k]*A[j*n + k];
+      A[i*n + j] = s/A[j*n + j];
+    }
+  }
+  for (int i = 0; i < n; ++i) {
+    for (int k = 0; k < i; ++k) b[i] -= A[i*n + k]*b[k];
+    b[i] /= A[i*n + i];
+  }
+  for (int i = n - 1; i >= 0; --i) {
+    for (int k = i + 1; k < n; ++k) b[i] -= A[k*n + i]*b[k];
+    b[i] /= A[i*n + i];
+  }
+  return true;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Forward model of the extinction spectrum on a fixed wavelength grid with its analytic Jacobian, and the
+  Levenberg-Marquardt fit built on it. The work arrays are allocated on construction and reused by every call, so
+  each thread needs its own object; copies are cheap next to a fit.
+----------------------------------------------------------------------------------------------------------------------*/
+class ExtinctionFitter
+{
+public:
+
+  ExtinctionFitter(
+    const bool &is_silver,                  // Material: true - silver, false - gold.
+    const int &n,                           // Number of wavelength points.
+    const double lambda[]);                 // Wavelengths in nm.
+
+  // Model scale*C_ext on the grid and, if J is not NULL, its derivatives with respect to the logarithms of the
+  // parameters: J[j*size() + i] for the parameter j of FitParam at the wavelength i.
+  void model(
+    const double p[FIT_PARAMS],             // Parameters in the order of FitParam.
+    double m[],                             // Output: model spectrum.
+    double J[]);                            // Output: Jacobian, FIT_PARAMS*size() values, or NULL.
+
+  // Fits a spectrum starting from p0; the parameters not marked free keep their values from p0.
+  FitResult fit(
+    const double y[],                       // Measured spectrum on the grid.
+    const double p0[FIT_PARAMS],            // Initial parameters.
+    const bool free[FIT_PARAMS],            // Parameters to fit.
+    const double &range = 10.0,             // L, H, R and eps_h stay within this factor of their initial values.
+    const int &max_iter = 100,              // Maximal number of iterations.
+    const double &tol = 1.0e-10);           // Relative decrease of the residual to stop at.
+
+  int size() const { return eps_.size(); }
+  bool isSilver() const { return eps_.isSilver(); }
+  const double *wavelengths() const { return eps_.wavelengths(); }
+
+private:
+
+  DielectricCache eps_;                     // Bulk permittivity on the grid.
+  std::vector<double> eps_re_, eps_im_;     // Size-dependent permittivity.
+  std::vector<double> alpha_re_, alpha_im_; // Polarizability.
+  std::vector<double> m_, J_, m_try_, J_try_;  // Model and Jacobian of the fit at the accepted and trial steps.
+};
+
+
+ExtinctionFitter::ExtinctionFitter(
+  const bool &is_silver,                    // Material: true - silver, false - gold.
+  const int &n,                             // Number of wavelength points.
+  const double lambda[])                    // Wavelengths in nm.
+  : eps_(is_silver, n, lambda), eps_re_(n), eps_im_(n), alpha_re_(n), alpha_im_(n), m_(n), J_((size_t)FIT_PARAMS*n),
+    m_try_(n), J_try_((size_t)FIT_PARAMS*n) {}
+
+
+void ExtinctionFitter::model(
+  const double p[FIT_PARAMS],               // Parameters in the order of FitParam.
+  double m[],                               // Output: model spectrum.
+  double J[])                               // Output: Jacobian, FIT_PARAMS*size() values, or NULL.
+{
+  const int n = size();
+  const double *lambda = eps_.wavelengths();
+  const double L = p[FIT_L], H = p[FIT_H], R = p[FIT_R], eps_h = p[FIT_EPS_H], scale = p[FIT_SCALE];
+
+  // Shape coefficients, as shapeCoef(), and their derivatives by ln L, ln H, ln R.
+  double shape[4], dshape[4][3];
+  for (int k = 0; k < 4; ++k) {
+    const ShapeFit &f = shape_fit[k];
+    double t1 = f.a1*pow(L/H, f.p1), t2 = f.a2*pow(L/R, f.p2), t3 = f.a3*pow(H/R, f.p3);
+    shape[k] = t1 + t2 + t3 + f.a0;
+    dshape[k][0] = f.p1*t1 + f.p2*t2;
+    dshape[k][1] = -f.p1*t1 + f.p3*t3;
+    dshape[k][2] = -f.p2*t2 - f.p3*t3;
+  }
+  const PrismModel prism(L, H, R, shape);
+  const PolarizCoef c = prism.coef(eps_h);
+
+  // Size-dependent permittivity and the polarizability, by the SIMD kernels.
+  const double D = diameter(L, H);
+  eps_.sizeDependentBatch(1, &D, eps_re_.data(), eps_im_.data());
+  prism.polarizBatch(n, lambda, eps_re_.data(), eps_im_.data(), eps_h, alpha_re_.data(), alpha_im_.data());
+  const double *eps_re = eps_re_.data(), *eps_im = eps_im_.data();
+  const double *alpha_re = alpha_re_.data(), *alpha_im = alpha_im_.data();
+
+  const double k0 = 8.0*M_PI*M_PI*std::sqrt(eps_h)*1.0e-14;  // C_ext = k0*Im(alpha)/lambda.
+  if (J == NULL) {
+    for (int i = 0; i < n; ++i) m[i] = scale*k0*alpha_im[i]/lambda[i];
+    return;
+  }
+
+  // Derivatives of the constants by ln L, ln H, ln R, ln eps_h.
+  const int nd = 4;
+  double dln_pref[nd], dinv_ec1[nd], da2[nd], da4[nd], dln_c3[nd], dln_s[nd], dln_D[nd];
+  for (int j = 0; j < 3; ++j) {
+    dln_pref[j] = dshape[0][j]/shape[0];
+    dinv_ec1[j] = -c.inv_ec1*c.inv_ec1*dshape[1][j];
+    da2[j] = dshape[2][j];
+    da4[j] = dshape[3][j];
+    dln_c3[j] = dshape[0][j]/shape[0];
+    dln_s[j] = 0.0;
+    dln_D[j] = 0.0;
+  }
+  dln_pref[FIT_L] += 2.0;                   // pref ~ L^2 H beta, c3 ~ beta H/L, s ~ L, D ~ (L^2 H)^(1/3).
+  dln_pref[FIT_H] += 1.0;
+  dln_c3[FIT_L] -= 1.0;
+  dln_c3[FIT_H] += 1.0;
+  dln_s[FIT_L] = 1.0;
+  dln_D[FIT_L] = 2.0/3.0;
+  dln_D[FIT_H] = 1.0/3.0;
+  dln_pref[FIT_EPS_H] = dinv_ec1[FIT_EPS_H] = da2[FIT_EPS_H] = da4[FIT_EPS_H] = dln_c3[FIT_EPS_H] = 0.0;
+  dln_s[FIT_EPS_H] = 0.5;
+  dln_D[FIT_EPS_H] = 0.0;
+
+  // The damping gam = gam_inf + const/D, so d gam/d ln D = -(gam - gam_inf).
+  const DrudeParams &dp = eps_.drude();
+  const double h_bar = 6.582e-16;
+  const double gam_inf = h_bar*dp.vF/dp.lam_inf;
+  const double gam = gam_inf + dp.A*h_bar*dp.vF*1.0e7*(2.0/D);
+  const double dgam = -(gam - gam_inf);
+  const double inv_pref = 1.0/c.pref;
+
+  for (int i = 0; i < n; ++i) {
+    const double s = c.sL/lambda[i], s2 = s*s, s3 = s2*s, s4 = s2*s2;
+
+    // Q = 1/q, q = eps_m/eps_h - 1; alpha = pref/d with d = Q - 1/(eps_c - 1) - Arc, as in polarizLane().
+    const double qr = eps_re[i]/c.eps_h - 1.0, qi = eps_im[i]/c.eps_h;
+    const double qn = qr*qr + qi*qi;
+    const double Qr = qr/qn, Qi = -qi/qn;
+    const double ar = alpha_re[i], ai = alpha_im[i];
+    const double k = scale*k0/lambda[i];
+    m[i] = k*ai;
+
+    // dQ = -Q^2 dq: dq/d ln D = (d eps/d gam) dgam/eps_h, dq/d ln eps_h = -(q + 1).
+    const double omega = 1239.8/lambda[i];
+    const double zr = omega*omega, zi = omega*gam;
+    const double z2r = zr*zr - zi*zi, z2i = 2.0*zr*zi, z2n = z2r*z2r + z2i*z2i;
+    const double ger = dp.omega_p*dp.omega_p*omega*z2i/z2n, gei = dp.omega_p*dp.omega_p*omega*z2r/z2n;
+    const double Q2r = Qr*Qr - Qi*Qi, Q2i = 2.0*Qr*Qi;
+    const double dqr = ger*dgam/c.eps_h, dqi = gei*dgam/c.eps_h;
+    const double dQDr = -(Q2r*dqr - Q2i*dqi), dQDi = -(Q2r*dqi + Q2i*dqr);
+    const double dQEr = Q2r*(qr + 1.0) - Q2i*qi, dQEi = Q2r*qi + Q2i*(qr + 1.0);
+
+    const double ur = ar*inv_pref, ui = ai*inv_pref;  // 1/d.
+    const double arc = 2.0*c.a2*s2 + 4.0*c.a4*s4;
+    for (int j = 0; j < nd; ++j) {
+      double ddr = dln_D[j]*dQDr - dinv_ec1[j] - s2*(da2[j] + s2*da4[j]) - arc*dln_s[j];
+      double ddi = dln_D[j]*dQDi - c.c3*s3*(dln_c3[j] + 3.0*dln_s[j]);
+      if (j == FIT_EPS_H) {
+        ddr += dQEr;
+        ddi += dQEi;
+      }
+      // d alpha = alpha (d ln pref - dd/d).
+      double er = ddr*ur - ddi*ui, ei = ddr*ui + ddi*ur;
+      J[j*n + i] = k*(dln_pref[j]*ai - (ar*ei + ai*er));
+    }
+    J[FIT_EPS_H*n + i] += 0.5*m[i];          // C_ext ~ sqrt(eps_h).
+    J[FIT_SCALE*n + i] = m[i];
+  }
+}
+
+
+FitResult ExtinctionFitter::fit(
+  const double y[],                         // Measured spectrum on the grid.
+  const double p0[FIT_PARAMS],              // Initial parameters.
+  const bool free[FIT_PARAMS],              // Parameters to fit.
+  const double &range,                      // L, H, R and eps_h stay within this factor of their initial values.
+  const int &max_iter,                      // Maximal number of iterations.
+  const double &tol)                        // Relative decrease of the residual to stop at.
+{
+  const int n = size();
+  int idx[FIT_PARAMS], nf = 0;
+  for (int j = 0; j < FIT_PARAMS; ++j)
+    if (free[j]) idx[nf++] = j;
+
+  FitResult res;
+  std::copy(p0, p0 + FIT_PARAMS, res.p);
+  res.iterations = 0;
+  res.converged = false;
+
+  std::vector<double> &m = m_, &J = J_, &m_try = m_try_, &J_try = J_try_;
+  auto residual = [&](const std::vector<double> &v) {
+    double chi2 = 0.0;
+    for (int i = 0; i < n; ++i) chi2 += (y[i] - v[i])*(y[i] - v[i]);
+    return chi2;
+  };
+
+  // A free scale starts from its linear least squares value.
+  if (free[FIT_SCALE]) {
+    res.p[FIT_SCALE] = 1.0;
+    model(res.p, m.data(), NULL);
+    double ym = 0.0, mm = 0.0;
+    for (int i = 0; i < n; ++i) {
+      ym += y[i]*m[i];
+      mm += m[i]*m[i];
+    }
+    res.p[FIT_SCALE] = ((ym > 0.0) && (mm > 0.0)) ? ym/mm : p0[FIT_SCALE];
+  }
+  model(res.p, m.data(), J.data());
+  double chi2 = residual(m);
+
+  double mu = 1.0e-3;
+  double A[FIT_PARAMS*FIT_PARAMS], g[FIT_PARAMS], S[FIT_PARAMS*FIT_PARAMS], delta[FIT_PARAMS];
+  while ((nf > 0) && (res.iterations < max_iter) && !res.converged) {
+    // Normal equations in the free parameters.
+    for (int a = 0; a < nf; ++a) {
+      const double *ja = J.data() + (size_t)idx[a]*n;
+      double ga = 0.0;
+      for (int i = 0; i < n; ++i) ga += ja[i]*(y[i] - m[i]);
+      g[a] = ga;
+      for (int b = 0; b <= a; ++b) {
+        const double *jb = J.data() + (size_t)idx[b]*n;
+        double s = 0.0;
+        for (int i = 0; i < n; ++i) s += ja[i]*jb[i];
+        A[a*nf + b] = A[b*nf + a] = s;
+      }
+    }
+
+    // Damped steps until one decreases the residual.
+    bool accepted = false;
+    while (!accepted && (mu < 1.0e12)) {
+      std::copy(A, A + nf*nf, S);
+      for (int a = 0; a < nf; ++a) S[a*nf + a] += mu*std::max(A[a*nf + a], 1.0e-30);
+      std::copy(g, g + nf, delta);
+      double p[FIT_PARAMS];
+      std::copy(res.p, res.p + FIT_PARAMS, p);
+      if (choleskySolve(nf, S, delta)) {
+        for (int a = 0; a < nf; ++a) {
+          int j = idx[a];
+          p[j] *= exp(std::min(std::max(delta[a], -1.0), 1.0));
+          if (j != FIT_SCALE) p[j] = std::min(std::max(p[j], p0[j]/range), p0[j]*range);
+        }
+        model(p, m_try.data(), J_try.data());
+        double chi2_try = residual(m_try);
+        if (std::isfinite(chi2_try) && (chi2_try < chi2)) {
+          accepted = true;
+          res.converged = chi2 - chi2_try <= tol*chi2;
+          chi2 = chi2_try;
+          std::copy(p, p + FIT_PARAMS, res.p);
+          m.swap(m_try);
+          J.swap(J_try);
+          mu = std::max(mu*0.3, 1.0e-12);
+          ++res.iterations;
+          continue;
+        }
+      }
+      mu *= 4.0;
+    }
+    if (!accepted) res.converged = true;    // No step decreases the residual: a minimum to rounding.
+  }
+  res.rms = std::sqrt(chi2/n);
+  return res;
+}
+
+
+/***********************************************************************************************************************
+  Polydisperse ensembles.
+
+  A sample holds prisms of different sizes. Its spectrum is the number-weighted mean of the cross sections over the
+  distribution of L, H and R, the axes being independent. The mean is taken by quadrature: a normal or lognormal
+  axis is sampled at the Gauss-Hermite nodes of its normal variable, a histogram at its bins, and the nodes of the
+  three axes form a tensor product. Each node is a particle with its own size-dependent permittivity at
+  D = diameter(L, H), which depends only on L and H, so it is computed once for all nodes of R. The particles are
+  evaluated across SIMD lanes at each wavelength in blocks that keep the work arrays in the cache.
+***********************************************************************************************************************/
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Kinds of distribution of a size:
+    DIST_FIXED     - a single value;
+    DIST_NORMAL    - normal, truncated at zero;
+    DIST_LOGNORMAL - lognormal with the given mean and standard deviation of the size itself;
+    DIST_HISTOGRAM - sizes with their relative numbers.
+----------------------------------------------------------------------------------------------------------------------*/
+enum DistributionType { DIST_FIXED, DIST_NORMAL, DIST_LOGNORMAL, DIST_HISTOGRAM };
+
+struct SizeDistribution
+{
+  DistributionType type;                    // Kind of distribution.
+  double mean, sd;                          // Mean and standard deviation in nm; DIST_FIXED uses the mean.
+  std::vector<double> value, weight;        // DIST_HISTOGRAM: sizes in nm and their relative numbers.
+};
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Gauss-Hermite quadrature for the standard normal density: sum w[i]*f(t[i]) is the mean of f(t), exact for
+  polynomials of degree below 2n. The roots of the Hermite polynomial are found by Newton's method from the
+  asymptotic estimates, the polynomials being evaluated by the recurrence of their normalized form.
+----------------------------------------------------------------------------------------------------------------------*/
+void gaussHermite(
+  const int &n,                             // Number of nodes.
+  double t[],                               // Output: nodes in decreasing order.
+  double w[])                               // Output: weights, summing to one.
+{
+  const double pi_m4 = 0.7511255444649425;  // pi^(-1/4).
+  double z = 0.0, dp = 1.0;
+  for (int i = 0; i < (n + 1)/2; ++i) {
+    if (i == 0) z = std::sqrt(2.0*n + 1.0) - 1.85575*std::pow(2.0*n + 1.0, -0.16667);
+    else if (i == 1) z -= 1.14*std::pow((double)n, 0.426)/z;
+    else if (i == 2) z = 1.86*z - 0.86*t[0];
+    else if (i == 3) z = 1.91*z - 0.91*t[1];
+    else z = 2.0*z - t[i - 2];
+    for (int iter = 0; iter < 100; ++iter) {
+      double p1 = pi_m4, p2 = 0.0;
+      for (int j = 0; j < n; ++j) {
+        const double p3 = p2;
+        p2 = p1;
+        p1 = z*std::sqrt(2.0/(j + 1))*p2 - std::sqrt((double)j/(j + 1))*p3;
+      }
+      dp = std::sqrt(2.0*n)*p2;
+      const double dz = p1/dp;
+      z -= dz;
+      if (std::fabs(dz) <= 3.0e-14) break;
+    }
+    t[i] = z;
+    t[n - 1 - i] = -z;
+    w[i] = w[n - 1 - i] = 2.0/(dp*dp);
+  }
+  for (int i = 0; i < n; ++i) {             // From the weight exp(-x^2) to the standard normal density.
+    t[i] *= M_SQRT2;
+    w[i] /= std::sqrt(M_PI);
+  }
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Quadrature nodes and weights of a distribution of a size; the weights sum to one. Nodes at non-positive sizes
+  and of zero weight are dropped, which truncates a wide normal distribution at zero.
+----------------------------------------------------------------------------------------------------------------------*/
+void distributionNodes(
+  const SizeDistribution &d,                // Distribution.
+  const int &order,                         // Number of Gauss-Hermite nodes of normal and lognormal distributions.
+  std::vector<double> &x,                   // Output: sizes in nm.
+  std::vector<double> &w)                   // Output: weights.
+{
+  x.clear();
+  w.clear();
+  if ((d.type != DIST_HISTOGRAM) && !(d.sd > 0.0)) {
+    x.push_back(d.mean);
+    w.push_back(1.0);
+    return;
+  }
+  if (d.type == DIST_HISTOGRAM) {
+    x = d.value;
+    w = d.weight;
+  } else {
+    x.resize(order);
+    w.resize(order);
+    gaussHermite(order, x.data(), w.data());
+    if (d.type == DIST_NORMAL)
+      for (int i = 0; i < order; ++i) x[i] = d.mean + d.sd*x[i];
+    else {
+      const double s2 = std::log(1.0 + (d.sd/d.mean)*(d.sd/d.mean));
+      const double mu = std::log(d.mean) - 0.5*s2, s = std::sqrt(s2);
+      for (int i = 0; i < order; ++i) x[i] = std::exp(mu + s*x[i]);
+    }
+  }
+
+  size_t m = 0;
+  double sum = 0.0;
+  for (size_t i = 0; i < x.size(); ++i)
+    if ((x[i] > 0.0) && (w[i] > 0.0)) {
+      x[m] = x[i];
+      w[m] = w[i];
+      sum += w[m++];
+    }
+  x.resize(m);
+  w.resize(m);
+  for (size_t i = 0; i < m; ++i) w[i] /= sum;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Number-weighted mean cross sections of an ensemble on the wavelength grid of the permittivity cache.
+----------------------------------------------------------------------------------------------------------------------*/
+struct EnsembleSpectrum
+{
+  std::vector<double> c_sca, c_ext, c_abs;  // Cross sections in cm^2.
+  long long nodes;                          // Number of particles of the quadrature.
+};
+
+
+EnsembleSpectrum ensembleSpectrum(
+  const DielectricCache &eps,               // Bulk permittivity of the material on the wavelength grid.
+  const SizeDistribution &L,                // Distribution of the edge length.
+  const SizeDistribution &H,                // Distribution of the thickness.
+  const SizeDistribution &R,                // Distribution of the triangle base corner radius.
+  const double &eps_h,                      // Dielectric permittivity of host media.
+  const int &order = 8)                     // Number of Gauss-Hermite nodes of a parametric axis.
+{
+  const int block = 256;                    // Particles evaluated together.
+  const int n = eps.size();
+  const double *lambda = eps.wavelengths();
+
+  std::vector<double> x[3], w[3];
+  distributionNodes(L, order, x[0], w[0]);
+  distributionNodes(H, order, x[1], w[1]);
+  distributionNodes(R, order, x[2], w[2]);
+  const int n_R = (int)x[2].size();
+  const long long n_LH = (long long)x[0].size()*x[1].size();
+
+  EnsembleSpectrum out;
+  out.c_sca.assign(n, 0.0);
+  out.c_ext.assign(n, 0.0);
+  out.c_abs.assign(n, 0.0);
+  out.nodes = n_LH*n_R;
+  if (out.nodes == 0) return out;
+
+  // Blocks of whole (L, H) pairs, R running fastest inside a pair.
+  const int pairs = std::max(block/std::max(n_R, 1), 1), size = pairs*n_R;
+  std::vector<double> bL(size), bH(size), bR(size), bw(size), D(pairs);
+  std::vector<double> eps_re((size_t)n*pairs), eps_im((size_t)n*pairs), e_re(size), e_im(size);
+  std::vector<double> a_re(size), a_im(size), c_sca(size), c_ext(size), c_abs(size);
+  for (long long first = 0; first < n_LH; first += pairs) {
+    const int np = (int)std::min((long long)pairs, n_LH - first), m = np*n_R;
+    for (int q = 0; q < np; ++q) {
+      const size_t iL = (size_t)((first + q)/x[1].size()), iH = (size_t)((first + q)%x[1].size());
+      D[q] = diameter(x[0][iL], x[1][iH]);
+      for (int r = 0; r < n_R; ++r) {
+        const int k = q*n_R + r;
+        bL[k] = x[0][iL];
+        bH[k] = x[1][iH];
+        bR[k] = x[2][r];
+        bw[k] = w[0][iL]*w[1][iH]*w[2][r];
+      }
+    }
+    eps.sizeDependentBatch(np, D.data(), eps_re.data(), eps_im.data());
+
+    for (int i = 0; i < n; ++i) {
+      for (int q = 0; q < np; ++q)
+        for (int r = 0; r < n_R; ++r) {
+          e_re[q*n_R + r] = eps_re[(size_t)q*n + i];
+          e_im[q*n_R + r] = eps_im[(size_t)q*n + i];
+        }
+      particleCrossSections(m, bL.data(), bH.data(), bR.data(), lambda[i], e_re.data(), e_im.data(), eps_h,
+                            a_re.data(), a_im.data(), c_sca.data(), c_ext.data(), c_abs.data());
+      double s_sca = 0.0, s_ext = 0.0, s_abs = 0.0;
+      for (int k = 0; k < m; ++k) {
+        s_sca += bw[k]*c_sca[k];
+        s_ext += bw[k]*c_ext[k];
+        s_abs += bw[k]*c_abs[k];
+      }
+      out.c_sca[i] += s_sca;
+      out.c_ext[i] += s_ext;
+      out.c_abs[i] += s_abs;
+    }
+  }
+  return out;
+}
+
+
+/***********************************************************************************************************************
+  Output of the results.
+***********************************************************************************************************************/
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Ways to write an output file:
+    OUTPUT_STDIO  - fwrite of the buffer when it is full;
+    OUTPUT_PWRITE - whole blocks aligned for O_DIRECT written by pwrite, bypassing the page cache where the file
+                    system allows it;
+    OUTPUT_URING  - the same blocks submitted through io_uring from registered buffers, so that the program fills
+                    the next block while the kernel writes the previous ones (Linux; OUTPUT_PWRITE elsewhere or if
+                    the kernel refuses).
+----------------------------------------------------------------------------------------------------------------------*/
+enum OutputBackend { OUTPUT_STDIO, OUTPUT_PWRITE, OUTPUT_URING };
+
+const size_t direct_align = 4096;           // Alignment of O_DIRECT buffers, offsets and lengths.
+
+
+#if defined(TRIANGLE_IO_URING)
+/*----------------------------------------------------------------------------------------------------------------------
+  Minimal io_uring submission/completion queue on the raw system calls, for writes of whole buffers.
+----------------------------------------------------------------------------------------------------------------------*/
+class UringQueue
+{
+public:
+
+  UringQueue() : fd_(-1), sq_ptr_(NULL), cq_ptr_(NULL), sqes_(NULL), fixed_(false) {}
+  ~UringQueue() { close(); }
+
+  // Creates the queue and registers the buffers; returns false if io_uring is not available.
+  bool open(
+    const unsigned &entries,                // Queue depth.
+    char *const bufs[],                     // Buffers.
+    const int &num_bufs,                    // Number of buffers.
+    const size_t &buf_size);                // Size of each buffer in bytes.
+
+  // Queues a write of buffer b and passes it to the kernel.
+  void write(
+    const int &fd,                          // File.
+    const int &b,                           // Index of the buffer.
+    const char *buf,                        // Buffer.
+    const size_t &len,                      // Number of bytes.
+    const off_t &offset);                   // Offset in the file.
+
+  // Waits for a completion; returns the index of the buffer and the result of the write.
+  void wait(
+    int &b,                                 // Output: index of the buffer.
+    int &res);                              // Output: number of bytes written or -errno.
+
+  void close();
+
+private:
+
+  int fd_;                                  // Ring.
+  void *sq_ptr_, *cq_ptr_;                  // Mapped rings.
+  size_t sq_len_, cq_len_;                  // Lengths of the mappings.
+  io_uring_sqe *sqes_;                      // Submission entries.
+  size_t sqes_len_;                         // Length of their mapping.
+  unsigned *sq_head_, *sq_tail_, *sq_mask_, *sq_array_;
+  unsigned *cq_head_, *cq_tail_, *cq_mask_;
+  io_uring_cqe *cqes_;                      // Completion entries.
+  bool fixed_;                              // The buffers are registered.
+
+  UringQueue(const UringQueue &);
+  UringQueue &operator=(const UringQueue &);
+};
+
+
+bool UringQueue::open(
+  const unsigned &entries,                  // Queue depth.
+  char *const bufs[],                       // Buffers.
+  const int &num_bufs,                      // Number of buffers.
+  const size_t &buf_size)                   // Size of each buffer in bytes.
+{
+  io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  fd_ = (int)syscall(__NR_io_uring_setup, entries, &p);
+  if (fd_ < 0) return false;
+
+  sq_len_ = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+  cq_len_ = p.cq_off.cqes + p.cq_entries*sizeof(io_uring_cqe);
+  bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single) sq_len_ = cq_len_ = std::max(sq_len_, cq_len_);
+  sq_ptr_ = mmap(NULL, sq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+  if (sq_ptr_ == MAP_FAILED) {
+    sq_ptr_ = NULL;
+    close();
+    return false;
+  }
+  cq_ptr_ = single ? sq_ptr_
+    : mmap(NULL, cq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+  sqes_len_ = p.sq_entries*sizeof(io_uring_sqe);
+  void *sqes = mmap(NULL, sqes_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+  if ((cq_ptr_ == MAP_FAILED) || (sqes == MAP_FAILED)) {
+    if (cq_ptr_ == MAP_FAILED) cq_ptr_ = NULL;
+    if (sqes != MAP_FAILED) sqes_ = (io_uring_sqe *)sqes;
+    close();
+    return false;
+  }
+  sqes_ = (io_uring_sqe *)sqes;
+
+  char *sq = (char *)sq_ptr_;
+  sq_head_ = (unsigned *)(sq + p.sq_off.head);
+  sq_tail_ = (unsigned *)(sq + p.sq_off.tail);
+  sq_mask_ = (unsigned *)(sq + p.sq_off.ring_mask);
+  sq_array_ = (unsigned *)(sq + p.sq_off.array);
+  char *cq = (char *)cq_ptr_;
+  cq_head_ = (unsigned *)(cq + p.cq_off.head);
+  cq_tail_ = (unsigned *)(cq + p.cq_off.tail);
+  cq_mask_ = (unsigned *)(cq + p.cq_off.ring_mask);
+  cqes_ = (io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  // Registered buffers save the kernel mapping the pages on every write; plain writes are used if the
+  // locked memory limit does not allow them.
+  std::vector<iovec> iov(num_bufs);
+  for (int b = 0; b < num_bufs; ++b) {
+    iov[b].iov_base = bufs[b];
+    iov[b].iov_len = buf_size;
+  }
+  fixed_ = syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, iov.data(), num_bufs) == 0;
+  return true;
+}
+
+
+void UringQueue::write(
+  const int &fd,                            // File.
+  const int &b,                             // Index of the buffer.
+  const char *buf,                          // Buffer.
+  const size_t &len,                        // Number of bytes.
+  const off_t &offset)                      // Offset in the file.
+{
+  unsigned tail = *sq_tail_;
+  unsigned idx = tail & *sq_mask_;
+  io_uring_sqe &sqe = sqes_[idx];
+  memset(&sqe, 0, sizeof(sqe));
+  sqe.opcode = fixed_ ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+  sqe.fd = fd;
+  sqe.addr = (unsigned long long)buf;
+  sqe.len = (unsigned)len;
+  sqe.off = (unsigned long long)offset;
+  sqe.buf_index = (unsigned short)(fixed_ ? b : 0);
+  sqe.user_data = (unsigned long long)b;
+  sq_array_[idx] = idx;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+  while (syscall(__NR_io_uring_enter, fd_, 1, 0, 0, NULL, 0) < 0) {
+    if ((errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY)) {
+      std::cout << "io_uring submission failed: " << strerror(errno) << std::endl;
+      exit(1);
+    }
+  }
+}
+
+
+void UringQueue::wait(
+  int &b,                                   // Output: index of the buffer.
+  int &res)                                 // Output: number of bytes written or -errno.
+{
+  for (;;) {
+    unsigned head = *cq_head_;
+    if (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+      const io_uring_cqe &cqe = cqes_[head & *cq_mask_];
+      b = (int)cqe.user_data;
+      res = cqe.res;
+      __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+      return;
+    }
+    if ((syscall(__NR_io_uring_enter, fd_, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) && (errno != EINTR)) {
+      std::cout << "io_uring wait failed: " << strerror(errno) << std::endl;
+      exit(1);
+    }
+  }
+}
+
+
+void UringQueue::close()
+{
+  if (sqes_ != NULL) munmap(sqes_, sqes_len_);
+  if ((cq_ptr_ != NULL) && (cq_ptr_ != sq_ptr_)) munmap(cq_ptr_, cq_len_);
+  if (sq_ptr_ != NULL) munmap(sq_ptr_, sq_len_);
+  if (fd_ >= 0) ::close(fd_);
+  fd_ = -1;
+  sq_ptr_ = cq_ptr_ = NULL;
+  sqes_ = NULL;
+  fixed_ = false;
+}
+#endif
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  File written in whole blocks from a small set of aligned buffers (OUTPUT_PWRITE and OUTPUT_URING). The file is
+  opened with O_DIRECT when the file system supports it. The last, partial block is padded to the alignment and
+  the file is truncated to the real length on close.
+----------------------------------------------------------------------------------------------------------------------*/
+class BlockFile
+{
+public:
+
+  BlockFile() : fd_(-1), uring_(false) {}
+  ~BlockFile() { finish(0); }
+
+  // Opens (truncates) the file; the program stops if the file cannot be created.
+  void open(
+    const std::string &name,                // File name.
+    const OutputBackend &backend,           // OUTPUT_PWRITE or OUTPUT_URING.
+    const size_t &block_size,               // Block size in bytes, rounded up to direct_align.
+    const int &num_bufs = 4);               // Number of buffers.
+
+  bool isOpen() const { return fd_ >= 0; }
+
+  // Backend in use, OUTPUT_PWRITE if io_uring is not available.
+  OutputBackend backend() const { return uring_ ? OUTPUT_URING : OUTPUT_PWRITE; }
+
+  // Block size in bytes.
+  size_t blockSize() const { return block_; }
+
+  // Buffer being filled, blockSize() + direct_align bytes; only the first blockSize() are written by submit().
+  char *buffer() { return bufs_[cur_]; }
+
+  // Writes the full current buffer at the end of the file and switches to the next buffer.
+  void submit();
+
+  // Overwrites bytes already given to the file; fill is the number of bytes in the current buffer.
+  void patch(
+    const off_t &offset,                    // Offset in bytes.
+    const void *data,                       // Bytes.
+    const size_t &len,                      // Number of bytes.
+    const size_t &fill);                    // Number of bytes in the current buffer.
+
+  // Writes fill bytes of the current buffer as the last block, waits for all writes and closes the file.
+  void finish(
+    const size_t &fill);                    // Number of bytes in the current buffer.
+
+private:
+
+  int fd_;                                  // File.
+  bool direct_;                             // The file is opened with O_DIRECT.
+  bool uring_;                              // Writes go through io_uring.
+  size_t block_;                            // Block size.
+  std::vector<char *> bufs_;                // Buffers.
+  std::vector<size_t> len_;                 // Length of the pending write of each buffer, 0 if none.
+  std::vector<off_t> off_;                  // Offset of the pending write of each buffer.
+  int cur_;                                 // Buffer being filled.
+  off_t offset_;                            // Offset of the current buffer in the file.
+#if defined(TRIANGLE_IO_URING)
+  UringQueue ring_;                         // Queue.
+#endif
+
+  BlockFile(const BlockFile &);
+  BlockFile &operator=(const BlockFile &);
+
+  // Writes a buffer synchronously. With O_DIRECT buf and offset are aligned to direct_align, and after a short
+  // write the rest is written from the last aligned offset, rewriting the partial block.
+  void pwriteAll(
+    const char *buf,                        // Bytes.
+    size_t len,                             // Number of bytes.
+    off_t offset);                          // Offset in the file.
+
+  // Bytes of a short write that can be skipped on retry: all of them, or with O_DIRECT the whole blocks.
+  size_t aligned(
+    const size_t &written) const            // Number of bytes written.
+  { return direct_ ? written/direct_align*direct_align : written; }
+
+  // Waits until buffer b is free.
+  void release(
+    const int &b);                          // Index of the buffer.
+
+  // Writes len bytes of the current buffer at offset_.
+  void issue(
+    const size_t &len);                     // Number of bytes, a multiple of direct_align.
+};
+
+
+void BlockFile::open(
+  const std::string &name,                  // File name.
+  const OutputBackend &backend,             // OUTPUT_PWRITE or OUTPUT_URING.
+  const size_t &block_size,                 // Block size in bytes, rounded up to direct_align.
+  const int &num_bufs)                      // Number of buffers.
+{
+  finish(0);
+  fd_ = ::open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+  direct_ = fd_ >= 0;
+  if (fd_ < 0) fd_ = ::open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0) {
+    std::cout << "Cannot open output file " << name << std::endl;
+    exit(1);
+  }
+
+  block_ = std::max((block_size + direct_align - 1)/direct_align, (size_t)1)*direct_align;
+  bufs_.assign(std::max(num_bufs, 2), (char *)NULL);
+  for (size_t b = 0; b < bufs_.size(); ++b)
+    if (posix_memalign((void **)&bufs_[b], direct_align, block_ + direct_align) != 0) {
+      std::cout << "Cannot allocate output buffers" << std::endl;
+      exit(1);
+    }
+  len_.assign(bufs_.size(), 0);
+  off_.assign(bufs_.size(), 0);
+  cur_ = 0;
+  offset_ = 0;
+
+  uring_ = false;
+#if defined(TRIANGLE_IO_URING)
+  if (backend == OUTPUT_URING)
+    uring_ = ring_.open((unsigned)bufs_.size(), bufs_.data(), (int)bufs_.size(), block_ + direct_align);
+#else
+  (void)backend;
+#endif
+}
+
+
+void BlockFile::pwriteAll(
+  const char *buf,                          // Bytes.
+  size_t len,                               // Number of bytes.
+  off_t offset)                             // Offset in the file.
+{
+  while (len > 0) {
+    ssize_t w = pwrite(fd_, buf, len, offset);
+    if ((w < 0) && (errno == EINTR)) continue;
+    if (w <= 0) {
+      std::cout << "Error writing output file: " << ((w < 0) ? strerror(errno) : "nothing written") << std::endl;
+      exit(1);
+    }
+    size_t done = ((size_t)w < len) ? aligned(w) : len;
+    buf += done;
+    len -= done;
+    offset += done;
+  }
+}
+
+
+void BlockFile::release(
+  const int &b)                             // Index of the buffer.
+{
+#if defined(TRIANGLE_IO_URING)
+  while (len_[b] != 0) {
+    int done, res;
+    ring_.wait(done, res);
+    if (res < 0) {
+      std::cout << "Error writing output file: " << strerror(-res) << std::endl;
+      exit(1);
+    }
+    if ((size_t)res < len_[done]) {         // Short write: the rest synchronously, from an aligned offset.
+      size_t keep = aligned(res);
+      pwriteAll(bufs_[done] + keep, len_[done] - keep, off_[done] + keep);
+    }
+    len_[done] = 0;
+  }
+#else
+  (void)b;
+#endif
+}
+
+
+void BlockFile::issue(
+  const size_t &len)                        // Number of bytes, a multiple of direct_align.
+{
+#if defined(TRIANGLE_IO_URING)
+  if (uring_) {
+    len_[cur_] = len;
+    off_[cur_] = offset_;
+    ring_.write(fd_, cur_, bufs_[cur_], len, offset_);
+    return;
+  }
+#endif
+  pwriteAll(bufs_[cur_], len, offset_);
+}
+
+
+void BlockFile::submit()
+{
+  issue(block_);
+  offset_ += block_;
+  cur_ = (cur_ + 1) % (int)bufs_.size();
+  release(cur_);
+}
+
+
+void BlockFile::patch(
+  const off_t &offset,                      // Offset in bytes.
+  const void *data,                         // Bytes.
+  const size_t &len,                        // Number of bytes.
+  const size_t &fill)                       // Number of bytes in the current buffer.
+{
+  const char *src = (const char *)data;
+  off_t end = offset + len;
+
+  // Part still in the current buffer.
+  if (end > offset_) {
+    off_t from = std::max(offset, offset_);
+    if ((size_t)(end - offset_) > fill) {
+      std::cout << "Patch of output file beyond its end" << std::endl;
+      exit(1);
+    }
+    memcpy(bufs_[cur_] + (from - offset_), src + (from - offset), end - from);
+    end = from;
+  }
+  if (end <= offset) return;
+
+  // Part already written: read-modify-write of the aligned pages, valid with and without O_DIRECT.
+  for (size_t b = 0; b < bufs_.size(); ++b) release((int)b);
+  off_t page0 = offset/direct_align*direct_align;
+  size_t span = (end - page0 + direct_align - 1)/direct_align*direct_align;
+  char *tmp;
+  if (posix_memalign((void **)&tmp, direct_align, span) != 0) {
+    std::cout << "Cannot allocate output buffers" << std::endl;
+    exit(1);
+  }
+  if (pread(fd_, tmp, span, page0) != (ssize_t)span) {
+    std::cout << "Error reading output file for patch" << std::endl;
+    exit(1);
+  }
+  memcpy(tmp + (offset - page0), src, end - offset);
+  pwriteAll(tmp, span, page0);
+  free(tmp);
+}
+
+
+void BlockFile::finish(
+  const size_t &fill)                       // Number of bytes in the current buffer.
+{
+  if (fd_ < 0) return;
+
+  if (fill > 0) {
+    size_t padded = (fill + direct_align - 1)/direct_align*direct_align;
+    memset(bufs_[cur_] + fill, 0, padded - fill);
+    issue(padded);
+  }
+  for (size_t b = 0; b < bufs_.size(); ++b) release((int)b);
+  if ((fill % direct_align != 0) && (ftruncate(fd_, offset_ + fill) != 0)) {
+    std::cout << "Error truncating output file: " << strerror(errno) << std::endl;
+    exit(1);
+  }
+
+#if defined(TRIANGLE_IO_URING)
+  ring_.close();
+#endif
+  ::close(fd_);
+  fd_ = -1;
+  for (size_t b = 0; b < bufs_.size(); ++b) free(bufs_[b]);
+  bufs_.clear();
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Output file written through a large buffer. Numbers are formatted by std::to_chars, which neither depends on the
+  locale nor goes through the stream machinery, and the data reach the file only when the buffer is full or on
+  close, so a spectrum costs a few large writes instead of one flush per line. With OUTPUT_PWRITE and OUTPUT_URING
+  the buffer is a block of BlockFile.
+----------------------------------------------------------------------------------------------------------------------*/
+class OutputFile
+{
+public:
+
+  OutputFile() : f_(NULL), owned_(false), buf_(NULL), cap_(0), pos_(0) {}
+  ~OutputFile() { close(); }
+
+  // Opens (truncates) the file; the program stops if the file cannot be created.
+  void open(
+    const std::string &name,                // File name.
+    const size_t &buffer_size = 1 << 20,    // Buffer size in bytes.
+    const OutputBackend &backend = OUTPUT_STDIO);  // Way to write the file.
+
+  // Writes to an open stream, e.g. stdout, which close() flushes but does not close.
+  void attach(
+    FILE *stream,                           // Stream.
+    const size_t &buffer_size = 1 << 20);   // Buffer size in bytes.
+
+  // Appends a number in the %g format with the given number of significant digits, 0 for the shortest
+  // representation which reads back exactly.
+  void put(
+    const double &x,                        // Number.
+    const int &precision)                   // Number of significant digits.
+  {
+    std::to_chars_result r = (precision > 0)
+      ? std::to_chars(buf_ + pos_, buf_ + cap_ + slack, x, std::chars_format::general, precision)
+      : std::to_chars(buf_ + pos_, buf_ + cap_ + slack, x);
+    if (r.ec != std::errc()) {
+      // Longer than the slack, which holds any number of up to 17 digits: formatted aside and copied.
+      std::vector<char> tmp(precision + 32);
+      r = std::to_chars(tmp.data(), tmp.data() + tmp.size(), x, std::chars_format::general, precision);
+      put(tmp.data(), r.ptr - tmp.data());
+      return;
+    }
+    pos_ = r.ptr - buf_;
+    if (pos_ >= cap_) spill();
+  }
+
+  // Appends a character.
+  void put(
+    const char &c)                          // Character.
+  {
+    buf_[pos_++] = c;
+    if (pos_ >= cap_) spill();
+  }
+
+  // Appends a string.
+  void put(
+    const char *str)                        // Null-terminated string.
+  {
+    put(str, strlen(str));
+  }
+
+  // Appends raw bytes.
+  void put(
+    const void *data,                       // Bytes.
+    size_t len)                             // Number of bytes.
+  {
+    const char *src = (const char *)data;
+    while (len > 0) {
+      size_t n = std::min(len, cap_ - pos_);
+      memcpy(buf_ + pos_, src, n);
+      pos_ += n;
+      src += n;
+      len -= n;
+      if (pos_ >= cap_) spill();
+    }
+  }
+
+  // Overwrites bytes already written at the given offset from the beginning of the file.
+  void patch(
+    const long &offset,                     // Offset in bytes.
+    const void *data,                       // Bytes.
+    const size_t &len);                     // Number of bytes.
+
+  // Writes the buffer to the file; with the block backends only whole blocks are written before close.
+  void flush();
+
+  // Writes the buffer and closes the file.
+  void close();
+
+private:
+
+  static constexpr size_t slack = 64;       // Room after the buffer for one formatted number.
+
+  FILE *f_;                                 // File for OUTPUT_STDIO.
+  bool owned_;                              // f_ was opened by open().
+  BlockFile block_;                         // File for the block backends.
+  std::vector<char> own_;                   // Buffer for OUTPUT_STDIO.
+  char *buf_;                               // Buffer.
+  size_t cap_;                              // Size of the buffer without the slack.
+  size_t pos_;                              // Number of bytes in the buffer.
+
+  OutputFile(const OutputFile &);
+  OutputFile &operator=(const OutputFile &);
+
+  // Writes out the full buffer and keeps the bytes beyond its size.
+  void spill();
+};
+
+
+void OutputFile::open(
+  const std::string &name,                  // File name.
+  const size_t &buffer_size,                // Buffer size in bytes.
+  const OutputBackend &backend)             // Way to write the file.
+{
+  close();
+  if (backend == OUTPUT_STDIO) {
+    f_ = fopen(name.c_str(), "wb");
+    if (f_ == NULL) {
+      std::cout << "Cannot open output file " << name << std::endl;
+      exit(1);
+    }
+    setvbuf(f_, NULL, _IONBF, 0);           // The buffer of the class is the only one.
+    owned_ = true;
+    cap_ = std::max(buffer_size, slack);
+    own_.resize(cap_ + slack);
+    buf_ = own_.data();
+  } else {
+    block_.open(name, backend, buffer_size);
+    cap_ = block_.blockSize();
+    buf_ = block_.buffer();
+  }
+  pos_ = 0;
+}
+
+
+void OutputFile::attach(
+  FILE *stream,                             // Stream.
+  const size_t &buffer_size)                // Buffer size in bytes.
+{
+  close();
+  f_ = stream;
+  owned_ = false;
+  cap_ = std::max(buffer_size, slack);
+  own_.resize(cap_ + slack);
+  buf_ = own_.data();
+  pos_ = 0;
+}
+
+
+void OutputFile::spill()
+{
+  if (f_ == NULL) {
+    size_t extra = pos_ - cap_;
+    block_.submit();
+    char *next = block_.buffer();
+    memcpy(next, buf_ + cap_, extra);
+    buf_ = next;
+    pos_ = extra;
+    return;
+  }
+  flush();
+}
+
+
+void OutputFile::flush()
+{
+  if (f_ == NULL) return;
+  if ((pos_ > 0) && (fwrite(buf_, 1, pos_, f_) != pos_)) {
+    std::cerr << "Error writing output file" << std::endl;
+    exit(1);
+  }
+  pos_ = 0;
+  if (!owned_) fflush(f_);
+}
+
+
+void OutputFile::patch(
+  const long &offset,                       // Offset in bytes.
+  const void *data,                         // Bytes.
+  const size_t &len)                        // Number of bytes.
+{
+  if (block_.isOpen()) {
+    block_.patch(offset, data, len, pos_);
+    return;
+  }
+  flush();
+  if ((fseek(f_, offset, SEEK_SET) != 0) || (fwrite(data, 1, len, f_) != len) || (fseek(f_, 0, SEEK_END) != 0)) {
+    std::cout << "Error writing output file" << std::endl;
+    exit(1);
+  }
+}
+
+
+void OutputFile::close()
+{
+  if (block_.isOpen()) {
+    block_.finish(pos_);
+    pos_ = 0;
+    return;
+  }
+  if (f_ == NULL) return;
+  flush();
+  if (owned_) fclose(f_);
+  f_ = NULL;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Layouts of the text output:
+    OUTPUT_COLUMNS - one file <prefix>-spectrum.dat with the columns
+                     lambda, Re(alpha), Im(alpha), C_sca, C_ext, C_abs;
+    OUTPUT_LEGACY  - the four two-column files <prefix>-polarizability_re.dat, -polarizability_im.dat,
+                     -scattering_cs.dat, -extinction_cs.dat of the original program;
+    OUTPUT_BINARY  - one file <prefix>-spectrum.bin in the format of triangle_result.h.
+----------------------------------------------------------------------------------------------------------------------*/
+enum OutputLayout { OUTPUT_COLUMNS, OUTPUT_LEGACY, OUTPUT_BINARY };
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Writer of spectra in one of the layouts. In the text layouts spectra of a sweep are written one after another as
+  blocks headed by a comment line with the parameters of the point and separated by blank lines. In the binary
+  layout each spectrum is a record with its parameters; all spectra of a file must share the wavelength grid.
+----------------------------------------------------------------------------------------------------------------------*/
+class SpectrumWriter
+{
+public:
+
+  SpectrumWriter(
+    const std::string &prefix,              // Beginning of the file names.
+    const OutputLayout &layout,             // Layout of the files.
+    const int &precision = 6,               // Significant digits, 0 for exact round trip.
+    const OutputBackend &backend = OUTPUT_STDIO);  // Way to write the files.
+
+  // Writer to an open stream, e.g. stdout, in the OUTPUT_COLUMNS or OUTPUT_BINARY layout. The record count of a
+  // binary stream is left 0, and readers take the number of records from its length.
+  SpectrumWriter(
+    FILE *stream,                           // Stream.
+    const OutputLayout &layout,             // Layout, OUTPUT_LEGACY is written as OUTPUT_COLUMNS.
+    const int &precision = 6);              // Significant digits, 0 for exact round trip.
+
+  // Writes a spectrum, one line per wavelength in the text layouts.
+  void write(
+    const SweepPoint &p,                    // Parameters of the particle, stored only in the binary layout.
+    const int &n,                           // Number of wavelength points.
+    const double lambda[],                  // Wavelengths in nm.
+    const double alpha_re[],                // Real part of polarizability in nm^3.
+    const double alpha_im[],                // Imaginary part of polarizability in nm^3.
+    const double c_sca[],                   // Scattering cross section in cm^2.
+    const double c_ext[],                   // Extinction cross section in cm^2.
+    const double c_abs[]);                  // Absorption cross section in cm^2.
+
+  // Writes the spectrum of a sweep point as a separate block.
+  void write(
+    const SweepResult &r);                  // Result of the sweep point.
+
+  // Passes the buffered data to the files.
+  void flush();
+
+  // Writes out the buffers and closes the files.
+  void close();
+
+private:
+
+  OutputLayout layout_;                     // Layout of the files.
+  int precision_;                           // Significant digits.
+  OutputFile files_[4];                     // Files; only the first one is used for OUTPUT_COLUMNS and OUTPUT_BINARY.
+  int num_files_;                           // Number of files in use.
+  long long num_records_;                   // Number of binary records written.
+  bool stream_;                             // Writing to a stream, which cannot be patched.
+  int num_wavelengths_;                     // Wavelength grid size of the binary file, -1 before the first record.
+
+  // Writes a binary record, and the header with the grid before the first one.
+  void writeRecord(
+    const long long &index,                 // Index of the point in the sweep.
+    const SweepPoint &p,                    // Parameters of the particle.
+    const int &n,                           // Number of wavelength points.
+    const double lambda[],                  // Wavelengths in nm.
+    const double *col[]);                   // Columns in the order of ResultColumn.
+};
+
+
+SpectrumWriter::SpectrumWriter(
+  const std::string &prefix,                // Beginning of the file names.
+  const OutputLayout &layout,               // Layout of the files.
+  const int &precision,                     // Significant digits, 0 for exact round trip.
+  const OutputBackend &backend)             // Way to write the files.
+  : layout_(layout), precision_(precision), num_files_(1), num_records_(0), stream_(false), num_wavelengths_(-1)
+{
+  const size_t buffer_size = 1 << 20;
+  if (layout_ == OUTPUT_BINARY) {
+    files_[0].open(prefix + "-spectrum.bin", buffer_size, backend);
+  } else if (layout_ == OUTPUT_LEGACY) {
+    num_files_ = 4;
+    files_[0].open(prefix + "-polarizability_re.dat", buffer_size, backend);
+    files_[1].open(prefix + "-polarizability_im.dat", buffer_size, backend);
+    files_[2].open(prefix + "-scattering_cs.dat", buffer_size, backend);
+    files_[3].open(prefix + "-extinction_cs.dat", buffer_size, backend);
+  } else {
+    files_[0].open(prefix + "-spectrum.dat", buffer_size, backend);
+    files_[0].put("# lambda(nm) Re(alpha)(nm^3) Im(alpha)(nm^3) C_sca(cm^2) C_ext(cm^2) C_abs(cm^2)\n");
+  }
+}
+
+
+SpectrumWriter::SpectrumWriter(
+  FILE *stream,                             // Stream.
+  const OutputLayout &layout,               // Layout, OUTPUT_LEGACY is written as OUTPUT_COLUMNS.
+  const int &precision)                     // Significant digits, 0 for exact round trip.
+  : layout_((layout == OUTPUT_BINARY) ? OUTPUT_BINARY : OUTPUT_COLUMNS), precision_(precision), num_files_(1),
+    num_records_(0), stream_(true), num_wavelengths_(-1)
+{
+  files_[0].attach(stream);
+  if (layout_ == OUTPUT_COLUMNS)
+    files_[0].put("# lambda(nm) Re(alpha)(nm^3) Im(alpha)(nm^3) C_sca(cm^2) C_ext(cm^2) C_abs(cm^2)\n");
+}
+
+
+void SpectrumWriter::writeRecord(
+  const long long &index,                   // Index of the point in the sweep.
+  const SweepPoint &p,                      // Parameters of the particle.
+  const int &n,                             // Number of wavelength points.
+  const double lambda[],                    // Wavelengths in nm.
+  const double *col[])                      // Columns in the order of ResultColumn.
+{
+  if (num_wavelengths_ < 0) {
+    ResultHeader h = resultHeader(n);
+    files_[0].put(&h, sizeof(h));
+    files_[0].put(lambda, n*sizeof(double));
+    num_wavelengths_ = n;
+  } else if (n != num_wavelengths_) {
+    std::cout << "All spectra of a binary result file must have the same wavelength grid" << std::endl;
+    exit(1);
+  }
+
+  ResultRecord r;
+  memset(&r, 0, sizeof(r));
+  r.index = index;
+  r.is_silver = p.is_silver ? 1 : 0;
+  r.L = p.L;
+  r.H = p.H;
+  r.R = p.R;
+  r.eps_h = p.eps_h;
+  files_[0].put(&r, sizeof(r));
+  for (int c = 0; c < RESULT_COLUMNS; ++c)
+    files_[0].put(col[c], n*sizeof(double));
+  ++num_records_;
+}
+
+
+void SpectrumWriter::write(
+  const SweepPoint &p,                      // Parameters of the particle, stored only in the binary layout.
+  const int &n,                             // Number of wavelength points.
+  const double lambda[],                    // Wavelengths in nm.
+  const double alpha_re[],                  // Real part of polarizability in nm^3.
+  const double alpha_im[],                  // Imaginary part of polarizability in nm^3.
+  const double c_sca[],                     // Scattering cross section in cm^2.
+  const double c_ext[],                     // Extinction cross section in cm^2.
+  const double c_abs[])                     // Absorption cross section in cm^2.
+{
+  if (layout_ == OUTPUT_BINARY) {
+    const double *col[RESULT_COLUMNS] = {alpha_re, alpha_im, c_sca, c_ext, c_abs};
+    writeRecord(num_records_, p, n, lambda, col);
+    return;
+  }
+
+  if (layout_ == OUTPUT_LEGACY) {
+    const double *col[4] = {alpha_re, alpha_im, c_sca, c_ext};
+    for (int f = 0; f < 4; ++f)
+      for (int i = 0; i < n; ++i) {
+        files_[f].put(lambda[i], precision_);
+        files_[f].put(' ');
+        files_[f].put(col[f][i], precision_);
+        files_[f].put('\n');
+      }
+    return;
+  }
+
+  const double *col[5] = {alpha_re, alpha_im, c_sca, c_ext, c_abs};
+  for (int i = 0; i < n; ++i) {
+    files_[0].put(lambda[i], precision_);
+    for (int c = 0; c < 5; ++c) {
+      files_[0].put(' ');
+      files_[0].put(col[c][i], precision_);
+    }
+    files_[0].put('\n');
+  }
+}
+
+
+void SpectrumWriter::write(
+  const SweepResult &r)                     // Result of the sweep point.
+{
+  if (layout_ == OUTPUT_BINARY) {
+    const double *col[RESULT_COLUMNS] = {r.alpha_re, r.alpha_im, r.c_sca, r.c_ext, r.c_abs};
+    writeRecord(r.index, r.point, r.n, r.lambda, col);
+    return;
+  }
+
+  for (int f = 0; f < num_files_; ++f) {
+    OutputFile &out = files_[f];
+    out.put("\n# point ");
+    out.put((double)r.index, 0);
+    out.put(r.point.is_silver ? " Ag L " : " Au L ");
+    out.put(r.point.L, 0);
+    out.put(" H ");
+    out.put(r.point.H, 0);
+    out.put(" R ");
+    out.put(r.point.R, 0);
+    out.put(" eps_h ");
+    out.put(r.point.eps_h, 0);
+    out.put('\n');
+  }
+  write(r.point, r.n, r.lambda, r.alpha_re, r.alpha_im, r.c_sca, r.c_ext, r.c_abs);
+}
+
+
+void SpectrumWriter::flush()
+{
+  for (int f = 0; f < num_files_; ++f) files_[f].flush();
+}
+
+
+void SpectrumWriter::close()
+{
+  if (layout_ == OUTPUT_BINARY) {
+    if (num_wavelengths_ < 0) {             // No spectra: a valid empty file.
+      ResultHeader h = resultHeader(0);
+      files_[0].put(&h, sizeof(h));
+      num_wavelengths_ = 0;
+    }
+    uint64_t num = num_records_;
+    if (!stream_) files_[0].patch(offsetof(ResultHeader, num_records), &num, sizeof(num));
+  }
+  for (int f = 0; f < num_files_; ++f) files_[f].close();
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Lock-free ring for one producer and one consumer thread. Each index is written by one side only, and the
+  release/acquire pair on it publishes the slot contents to the other side.
+----------------------------------------------------------------------------------------------------------------------*/
+template <typename T>
+class SpscRing
+{
+public:
+
+  explicit SpscRing(
+    const size_t &capacity)                 // Maximal number of elements.
+    : buf_(capacity + 1), head_(0), tail_(0) {}
+
+  // Adds an element; returns false if the ring is full. Called by the producer only.
+  bool push(
+    const T &x)                             // Element.
+  {
+    size_t t = tail_.load(std::memory_order_relaxed);
+    size_t next = (t + 1 == buf_.size()) ? 0 : t + 1;
+    if (next == head_.load(std::memory_order_acquire)) return false;
+    buf_[t] = x;
+    tail_.store(next, std::memory_order_release);
+    return true;
+  }
+
+  // Takes the oldest element; returns false if the ring is empty. Called by the consumer only.
+  bool pop(
+    T &x)                                   // Output: element.
+  {
+    size_t h = head_.load(std::memory_order_relaxed);
+    if (h == tail_.load(std::memory_order_acquire)) return false;
+    x = buf_[h];
+    head_.store((h + 1 == buf_.size()) ? 0 : h + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+
+  std::vector<T> buf_;                      // Slots, one always empty.
+  alignas(64) std::atomic<size_t> head_;    // Next slot to read, written by the consumer.
+  alignas(64) std::atomic<size_t> tail_;    // Next slot to write, written by the producer.
+};
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Waiting for the other side of a ring: yield first, then sleep, so that an idle thread does not take a core.
+----------------------------------------------------------------------------------------------------------------------*/
+inline void ringBackoff(
+  int &spins)                               // Number of unsuccessful attempts so far, updated.
+{
+  if (++spins < 64)
+    std::this_thread::yield();
+  else
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Block of copied sweep results passed to the writer thread. The arrays keep their capacity between uses, so a
+  block stops allocating after the first few spectra.
+----------------------------------------------------------------------------------------------------------------------*/
+struct ResultBlock
+{
+  std::vector<long long> index;             // Indices of the points in the sweep.
+  std::vector<SweepPoint> point;            // Parameters of the points.
+  std::vector<int> n;                       // Numbers of wavelength points.
+  std::vector<size_t> offset;               // Beginning of each spectrum in data.
+  std::vector<double> data;                 // Wavelengths and the five columns of each spectrum.
+
+  int size() const { return (int)index.size(); }
+
+  void clear()
+  {
+    index.clear();
+    point.clear();
+    n.clear();
+    offset.clear();
+    data.clear();
+  }
+};
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Writer which formats and writes spectra on its own thread. The producer (e.g. the consumer of SweepEngine::run)
+  copies results into blocks from a fixed pool and passes full blocks to the I/O thread through a lock-free ring;
+  the I/O thread returns written blocks through another ring. The producer waits only when all blocks are waiting
+  for the disk, so memory is bounded by the pool. write() and close() must be called from one thread.
+----------------------------------------------------------------------------------------------------------------------*/
+class AsyncSpectrumWriter
+{
+public:
+
+  AsyncSpectrumWriter(
+    const std::string &prefix,              // Beginning of the file names.
+    const OutputLayout &layout,             // Layout of the files.
+    const int &precision = 6,               // Significant digits, 0 for exact round trip.
+    const OutputBackend &backend = OUTPUT_STDIO,  // Way to write the files.
+    const int &num_blocks = 8,              // Number of blocks in the pool.
+    const int &block_size = 64);            // Number of spectra in a block.
+
+  ~AsyncSpectrumWriter() { close(); }
+
+  // Queues the spectrum of a sweep point.
+  void write(
+    const SweepResult &r);                  // Result of the sweep point.
+
+  // Passes the partially filled block to the I/O thread.
+  void flush();
+
+  // Writes all queued spectra, closes the files and stops the I/O thread.
+  void close();
+
+  // Consumer for SweepEngine::run.
+  SweepSink sink() { return [this](const SweepResult &r) { write(r); }; }
+
+private:
+
+  SpectrumWriter writer_;                   // Used by the I/O thread only once it is started.
+  std::vector<ResultBlock> pool_;           // Blocks.
+  SpscRing<ResultBlock *> full_;            // Blocks to write, NULL to stop.
+  SpscRing<ResultBlock *> free_;            // Written blocks.
+  ResultBlock *current_;                    // Block being filled by the producer.
+  int block_size_;                          // Number of spectra in a block.
+  bool closed_;                             // The I/O thread has been stopped.
+  std::thread io_;                          // I/O thread.
+
+  AsyncSpectrumWriter(const AsyncSpectrumWriter &);
+  AsyncSpectrumWriter &operator=(const AsyncSpectrumWriter &);
+
+  // Passes a block, or NULL to stop, to the I/O thread.
+  void submit(
+    ResultBlock *block);                    // Block.
+
+  // Body of the I/O thread.
+  void ioLoop();
+};
+
+
+AsyncSpectrumWriter::AsyncSpectrumWriter(
+  const std::string &prefix,                // Beginning of the file names.
+  const OutputLayout &layout,               // Layout of the files.
+  const int &precision,                     // Significant digits, 0 for exact round trip.
+  const OutputBackend &backend,             // Way to write the files.
+  const int &num_blocks,                    // Number of blocks in the pool.
+  const int &block_size)                    // Number of spectra in a block.
+  : writer_(prefix, layout, precision, backend), pool_(std::max(num_blocks, 2)),
+    full_(pool_.size() + 1), free_(pool_.size()), current_(NULL), block_size_(std::max(block_size, 1)),
+    closed_(false)
+{
+  for (size_t b = 0; b < pool_.size(); ++b) free_.push(&pool_[b]);
+  io_ = std::thread(&AsyncSpectrumWriter::ioLoop, this);
+}
+
+
+void AsyncSpectrumWriter::write(
+  const SweepResult &r)                     // Result of the sweep point.
+{
+  if (current_ == NULL) {
+    int spins = 0;
+    while (!free_.pop(current_)) ringBackoff(spins);
+  }
+
+  ResultBlock &b = *current_;
+  b.index.push_back(r.index);
+  b.point.push_back(r.point);
+  b.n.push_back(r.n);
+  b.offset.push_back(b.data.size());
+  const double *col[6] = {r.lambda, r.alpha_re, r.alpha_im, r.c_sca, r.c_ext, r.c_abs};
+  for (int c = 0; c < 6; ++c) b.data.insert(b.data.end(), col[c], col[c] + r.n);
+
+  if (b.size() >= block_size_) flush();
+}
+
+
+void AsyncSpectrumWriter::flush()
+{
+  if ((current_ == NULL) || (current_->size() == 0)) return;
+  submit(current_);
+  current_ = NULL;
+}
+
+
+void AsyncSpectrumWriter::close()
+{
+  if (closed_) return;
+  flush();
+  submit(NULL);
+  io_.join();
+  closed_ = true;
+}
+
+
+void AsyncSpectrumWriter::submit(
+  ResultBlock *block)                       // Block.
+{
+  int spins = 0;
+  while (!full_.push(block)) ringBackoff(spins);
+}
+
+
+void AsyncSpectrumWriter::ioLoop()
+{
+  for (;;) {
+    ResultBlock *block;
+    int spins = 0;
+    while (!full_.pop(block)) ringBackoff(spins);
+    if (block == NULL) break;
+
+    for (int k = 0; k < block->size(); ++k) {
+      const int n = block->n[k];
+      const double *d = block->data.data() + block->offset[k];
+      SweepResult r = {block->index[k], block->point[k], n, d, d + n, d + 2*n, d + 3*n, d + 4*n, d + 5*n};
+      writer_.write(r);
+    }
+    block->clear();
+    free_.push(block);
+  }
+  writer_.close();
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Benchmark of the output paths: the spectrum of the example particle is written num_spectra times by the original
+  code (four std::ofstream with std::endl on every line) and by SpectrumWriter in each layout and backend. Times
+  include closing the files but no fsync, so the cached paths show the speed of the page cache while O_DIRECT
+  writes reach the device. The files are removed afterwards.
+----------------------------------------------------------------------------------------------------------------------*/
+void outputBenchmark(
+  const std::string &prefix,                // Beginning of the file names.
+  const int &num_spectra)                   // Number of spectra to write.
+{
+  const int n = 251;
+  std::vector<double> wl(n), a_re(n), a_im(n), c_sca(n), c_ext(n), c_abs(n);
+  std::vector<std::complex<double> > eps_m(n), alpha(n);
+  for (int i = 0; i < n; ++i) wl[i] = 300.0 + 2.0*i;
+  const DielectricCache eps_bulk(true, n, wl.data());
+  for (int i = 0; i < n; ++i) eps_m[i] = eps_bulk.sizeDependent(i, diameter(50.0, 20.0));
+  const PrismModel prism(50.0, 20.0, 2.0);
+  prism.spectrum(n, wl.data(), eps_m.data(), 1.0, alpha.data(), c_sca.data(), c_ext.data(), c_abs.data());
+  for (int i = 0; i < n; ++i) {
+    a_re[i] = std::real(alpha[i]);
+    a_im[i] = std::imag(alpha[i]);
+  }
+  const SweepPoint point = {50.0, 20.0, 2.0, 1.0, true};
+
+  const char *layout_name[3] = {"columns", "legacy", "binary"};
+  const char *backend_name[3] = {"stdio", "pwrite", "io_uring"};
+  const char *suffix[6] = {"-spectrum.dat", "-polarizability_re.dat", "-polarizability_im.dat",
+                           "-scattering_cs.dat", "-extinction_cs.dat", "-spectrum.bin"};
+#if !defined(TRIANGLE_IO_URING)
+  std::cout << "io_uring is not available in this build, the io_uring rows use pwrite." << std::endl;
+#endif
+  std::cout << num_spectra << " spectra of " << n << " points, no fsync." << std::endl;
+
+  // Size of the files of a run, removing them.
+  auto collect = [&]() {
+    double bytes = 0.0;
+    for (int k = 0; k < 6; ++k) {
+      std::string name = prefix + suffix[k];
+      struct stat st;
+      if (stat(name.c_str(), &st) == 0) {
+        bytes += st.st_size;
+        remove(name.c_str());
+      }
+    }
+    return bytes;
+  };
+  auto report = [&](const std::string &what, const double &seconds, const double &bytes) {
+    char line[160];
+    snprintf(line, sizeof(line), "  %-28s %9.1f MB %8.3f s %9.1f MB/s", what.c_str(), bytes*1.0e-6, seconds,
+             bytes*1.0e-6/seconds);
+    std::cout << line << std::endl;
+  };
+
+  // The original output code of the example program.
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  {
+    std::ofstream fout_re((prefix + suffix[1]).c_str(), std::ios::out);
+    std::ofstream fout_im((prefix + suffix[2]).c_str(), std::ios::out);
+    std::ofstream fout_sc((prefix + suffix[3]).c_str(), std::ios::out);
+    std::ofstream fout_ex((prefix + suffix[4]).c_str(), std::ios::out);
+    for (int s = 0; s < num_spectra; ++s)
+      for (int i = 0; i < n; ++i) {
+        fout_re << wl[i] << " " << a_re[i] << std::endl;
+        fout_im << wl[i] << " " << a_im[i] << std::endl;
+        fout_sc << wl[i] << " " << c_sca[i] << std::endl;
+        fout_ex << wl[i] << " " << c_ext[i] << std::endl;
+      }
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  report("legacy ofstream+endl", seconds, collect());
+
+  for (int layout = 0; layout < 3; ++layout)
+    for (int backend = 0; backend < 3; ++backend) {
+      t0 = std::chrono::steady_clock::now();
+      {
+        SpectrumWriter out(prefix, (OutputLayout)layout, 6, (OutputBackend)backend);
+        for (int s = 0; s < num_spectra; ++s)
+          out.write(point, n, wl.data(), a_re.data(), a_im.data(), c_sca.data(), c_ext.data(), c_abs.data());
+        out.close();
+      }
+      seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+      report(std::string(layout_name[layout]) + " " + backend_name[backend], seconds, collect());
+    }
+}
+
+
+/***********************************************************************************************************************
+  Command line and job files.
+
+  Each job is a set of key=value parameters:
+    L=, H=, R=      edge length, thickness and triangle base corner radius in nm;
+    eps_h=          dielectric permittivity of host media;
+                    each of the above is a value or a sweep range min:max:n;
+    material=       ag, au or both;
+    wl=             wavelength grid min:max:step in nm, or separately wl_min=, wl_max=, wl_step=;
+    out=            beginning of the output file names;
+    layout=         columns, legacy or binary (see OutputLayout);
+    backend=        stdio, pwrite or uring (see OutputBackend);
+    precision=      significant digits of text output, 1 to 17, 0 for the shortest exact round trip;
+    threads=, chunk= worker threads and points per work item of sweeps, 0 - default;
+    memory=         megabytes of sweep results held for in-order output, 0 - default (64);
+    dist_L=, dist_H=, dist_R=  size distributions of ensembles (see parseDistribution), replacing the axis;
+    nodes=          Gauss-Hermite nodes of a normal or lognormal distribution.
+  The command line gives one job; with --jobs FILE it gives the defaults for the jobs of the file, one per line,
+  with # starting a comment, e.g.:
+    L=50 H=20 R=2 material=ag out=prism50
+    L=20:120:11 H=10:30:5 R=2 material=both wl=300:900:1 layout=binary out=sweep
+  Jobs of a file without out= are written to <out>-<number of the job>. All jobs run in one process.
+***********************************************************************************************************************/
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Parameters of a job.
+----------------------------------------------------------------------------------------------------------------------*/
+struct Job
+{
+  SweepSpec sweep;                          // Particles, host media, materials and wavelength grid.
+  std::string prefix;                       // Beginning of the output file names.
+  OutputLayout layout;                      // Layout of the output.
+  OutputBackend backend;                    // Way to write the output.
+  int precision;                            // Significant digits of text output, 0 for exact round trip.
+  double adaptive;                          // Tolerance of adaptive wavelength sampling, 0 - uniform grid.
+  bool fit_eps_h, fit_scale;                // Fit of measured spectra: also fit eps_h, the scale.
+  SizeDistribution dist[3];                 // Ensembles: distributions of L, H, R; DIST_FIXED - the sweep value.
+  int nodes;                                // Ensembles: Gauss-Hermite nodes of a parametric distribution.
+};
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Parameters of the example calculation, used where a job does not set them.
+----------------------------------------------------------------------------------------------------------------------*/
+Job defaultJob()
+{
+  Job job;
+  job.sweep.L = {50.0, 50.0, 1};            // Edge length in nm.
+  job.sweep.R = {2.0, 2.0, 1};              // Triangle base corner radius in nm.
+  job.sweep.H = {20.0, 20.0, 1};            // Thickness in nm.
+
+  job.sweep.eps_h = {1.0, 1.0, 1};          // Dielectric permittivity of host media.
+  job.sweep.silver = true;                  // Materials: silver ...
+  job.sweep.gold = false;                   // ... and/or gold.
+
+  job.sweep.wl_min = 300.0;                 // Minimal value of wavelength range to print results in nm.
+  job.sweep.wl_max = 800.0;                 // Maximal value of wavelength range to print results in nm.
+  job.sweep.wl_step = 2.0;                  // Wavelength step to print results in nm.
+
+  job.sweep.chunk = 0;                      // Default work items of sweeps.
+  job.sweep.threads = 0;                    // One worker per hardware thread.
+  job.sweep.memory = 0;                     // Default window of sweep results.
+
+  job.prefix = "analytic_model";
+  job.layout = OUTPUT_COLUMNS;
+  job.backend = OUTPUT_STDIO;
+  job.precision = 6;
+  job.adaptive = 0.0;
+  job.fit_eps_h = false;
+  job.fit_scale = true;
+  for (int j = 0; j < 3; ++j) {
+    job.dist[j].type = DIST_FIXED;
+    job.dist[j].mean = job.dist[j].sd = 0.0;
+  }
+  job.nodes = 8;
+  return job;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Number from the whole of a string.
+----------------------------------------------------------------------------------------------------------------------*/
+template <typename T>
+bool parseNumber(
+  const std::string &str,                   // String.
+  T &x)                                     // Output: number.
+{
+  const char *end = str.data() + str.size();
+  std::from_chars_result r = std::from_chars(str.data(), end, x);
+  return (r.ec == std::errc()) && (r.ptr == end) && !str.empty();
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Sweep axis from "value" or "min:max:n".
+----------------------------------------------------------------------------------------------------------------------*/
+bool parseAxis(
+  const std::string &str,                   // String.
+  SweepAxis &axis)                          // Output: axis.
+{
+  size_t c1 = str.find(':');
+  if (c1 == std::string::npos) {
+    axis.n = 1;
+    return parseNumber(str, axis.min) && parseNumber(str, axis.max);
+  }
+  size_t c2 = str.find(':', c1 + 1);
+  return (c2 != std::string::npos) && parseNumber(str.substr(0, c1), axis.min)
+    && parseNumber(str.substr(c1 + 1, c2 - c1 - 1), axis.max) && parseNumber(str.substr(c2 + 1), axis.n)
+    && (axis.n >= 1);
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Size distribution from "normal:mean:sd", "lognormal:mean:sd" or "histogram:x1:w1:x2:w2:...", sizes in nm.
+----------------------------------------------------------------------------------------------------------------------*/
+bool parseDistribution(
+  const std::string &str,                   // String.
+  SizeDistribution &d)                      // Output: distribution.
+{
+  std::vector<double> v;
+  size_t pos = str.find(':');
+  const std::string kind = str.substr(0, pos);
+  while (pos != std::string::npos) {
+    size_t next = str.find(':', pos + 1);
+    double x;
+    if (!parseNumber(str.substr(pos + 1, (next == std::string::npos) ? std::string::npos : next - pos - 1), x))
+      return false;
+    v.push_back(x);
+    pos = next;
+  }
+
+  d.value.clear();
+  d.weight.clear();
+  d.mean = d.sd = 0.0;
+  if ((kind == "normal") || (kind == "lognormal")) {
+    d.type = (kind == "normal") ? DIST_NORMAL : DIST_LOGNORMAL;
+    if ((v.size() != 2) || !(v[0] > 0.0) || !(v[1] >= 0.0)) return false;
+    d.mean = v[0];
+    d.sd = v[1];
+    return true;
+  }
+  if (kind != "histogram") return false;
+  d.type = DIST_HISTOGRAM;
+  double sum = 0.0;
+  for (size_t i = 0; i + 1 < v.size(); i += 2) {
+    if (!(v[i] > 0.0) || !(v[i + 1] >= 0.0)) return false;
+    d.value.push_back(v[i]);
+    d.weight.push_back(v[i + 1]);
+    sum += v[i + 1];
+  }
+  return (v.size() % 2 == 0) && (sum > 0.0);
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Sets a parameter of a job from "key=value" (a leading "--" is allowed); returns false with a message on error.
+----------------------------------------------------------------------------------------------------------------------*/
+bool setJobParam(
+  Job &job,                                 // Job, updated.
+  const std::string &token,                 // Parameter.
+  std::string &error)                       // Output: message on error.
+{
+  std::string t = (token.compare(0, 2, "--") == 0) ? token.substr(2) : token;
+  size_t eq = t.find('=');
+  if (eq == std::string::npos) {
+    error = "expected key=value: " + token;
+    return false;
+  }
+  std::string key = t.substr(0, eq);
+  std::string value = t.substr(eq + 1);
+  SweepSpec &s = job.sweep;
+
+  bool ok = true;
+  if (key == "L") ok = parseAxis(value, s.L);
+  else if (key == "H") ok = parseAxis(value, s.H);
+  else if (key == "R") ok = parseAxis(value, s.R);
+  else if (key == "eps_h") ok = parseAxis(value, s.eps_h);
+  else if (key == "material") {
+    ok = (value == "ag") || (value == "au") || (value == "both");
+    s.silver = (value != "au");
+    s.gold = (value != "ag");
+  } else if (key == "wl") {
+    size_t c1 = value.find(':'), c2 = value.rfind(':');
+    ok = (c1 != std::string::npos) && (c2 != c1) && parseNumber(value.substr(0, c1), s.wl_min)
+      && parseNumber(value.substr(c1 + 1, c2 - c1 - 1), s.wl_max) && parseNumber(value.substr(c2 + 1), s.wl_step);
+  }
+  else if (key == "wl_min") ok = parseNumber(value, s.wl_min);
+  else if (key == "wl_max") ok = parseNumber(value, s.wl_max);
+  else if (key == "wl_step") ok = parseNumber(value, s.wl_step);
+  else if (key == "out") ok = !(job.prefix = value).empty();
+  else if (key == "layout") {
+    ok = (value == "columns") || (value == "legacy") || (value == "binary");
+    job.layout = (value == "legacy") ? OUTPUT_LEGACY : (value == "binary") ? OUTPUT_BINARY : OUTPUT_COLUMNS;
+  } else if (key == "backend") {
+    ok = (value == "stdio") || (value == "pwrite") || (value == "uring");
+    job.backend = (value == "pwrite") ? OUTPUT_PWRITE : (value == "uring") ? OUTPUT_URING : OUTPUT_STDIO;
+  }
+  else if (key == "precision") ok = parseNumber(value, job.precision) && (job.precision >= 0) && (job.precision <= 17);
+  else if (key == "threads") ok = parseNumber(value, s.threads) && (s.threads >= 0);
+  else if (key == "chunk") ok = parseNumber(value, s.chunk) && (s.chunk >= 0);
+  else if (key == "memory") ok = parseNumber(value, s.memory) && (s.memory >= 0);
+  else if (key == "adaptive") ok = parseNumber(value, job.adaptive) && (job.adaptive >= 0.0);
+  else if ((key == "fit_eps_h") || (key == "fit_scale")) {
+    ok = (value == "0") || (value == "1");
+    ((key == "fit_eps_h") ? job.fit_eps_h : job.fit_scale) = (value == "1");
+  }
+  else if (key == "dist_L") ok = parseDistribution(value, job.dist[0]);
+  else if (key == "dist_H") ok = parseDistribution(value, job.dist[1]);
+  else if (key == "dist_R") ok = parseDistribution(value, job.dist[2]);
+  else if (key == "nodes") ok = parseNumber(value, job.nodes) && (job.nodes >= 1) && (job.nodes <= 64);
+  else {
+    error = "unknown parameter: " + key;
+    return false;
+  }
+
+  if (ok && key.compare(0, 2, "wl") == 0) ok = (s.wl_step > 0.0) && (s.wl_max >= s.wl_min);
+  if (!ok) error = "invalid value of " + key + ": " + value;
+  return ok;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Reads the jobs of a file; the program stops with the line of the first error.
+----------------------------------------------------------------------------------------------------------------------*/
+std::vector<Job> readJobFile(
+  const std::string &name,                  // File name.
+  const Job &defaults)                      // Parameters not set in the file.
+{
+  std::ifstream fin(name.c_str());
+  if (!fin) {
+    std::cout << "Cannot open job file " << name << std::endl;
+    exit(1);
+  }
+
+  std::vector<Job> jobs;
+  std::string line;
+  for (int line_no = 1; std::getline(fin, line); ++line_no) {
+    size_t hash = line.find('#');
+    if (hash != std::string::npos) line.erase(hash);
+
+    Job job = defaults;
+    job.prefix = defaults.prefix + "-" + std::to_string(jobs.size() + 1);
+    bool empty = true;
+    size_t pos = 0;
+    for (;;) {
+      size_t begin = line.find_first_not_of(" \t\r", pos);
+      if (begin == std::string::npos) break;
+      size_t end = line.find_first_of(" \t\r", begin);
+      std::string token = line.substr(begin, (end == std::string::npos) ? std::string::npos : end - begin);
+      std::string error;
+      if (!setJobParam(job, token, error)) {
+        std::cout << name << ":" << line_no << ": " << error << std::endl;
+        exit(1);
+      }
+      empty = false;
+      pos = end;
+    }
+    if (!empty) jobs.push_back(job);
+  }
+  return jobs;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Runs a job: a single particle is computed directly, several particles by the sweep engine; with adaptive
+  sampling every spectrum gets its own wavelength grid.
+----------------------------------------------------------------------------------------------------------------------*/
+void runJob(
+  const Job &job)                           // Parameters of the job.
+{
+  const SweepSpec &s = job.sweep;
+  SweepEngine engine(s);
+
+  if (job.adaptive > 0.0) {
+    if ((engine.size() > 1) && (job.layout == OUTPUT_BINARY)) {
+      std::cout << job.prefix << ": adaptive sampling of several spectra needs a text layout" << std::endl;
+      return;
+    }
+    SpectrumWriter out(job.prefix, job.layout, job.precision, job.backend);
+    long long evaluations = 0;
+    for (long long i = 0; i < engine.size(); ++i) {
+      const SweepPoint p = engine.point(i);
+      const PrismModel prism(p.L, p.H, p.R);
+      const AdaptiveSpectrum a = adaptiveSpectrum(prism, p.is_silver, p.eps_h, s.wl_min, s.wl_max, job.adaptive);
+      const SweepResult r = {i, p, (int)a.lambda.size(), a.lambda.data(), a.alpha_re.data(), a.alpha_im.data(),
+                             a.c_sca.data(), a.c_ext.data(), a.c_abs.data()};
+      if (engine.size() > 1)
+        out.write(r);
+      else
+        out.write(p, r.n, r.lambda, r.alpha_re, r.alpha_im, r.c_sca, r.c_ext, r.c_abs);
+      evaluations += a.evaluations;
+    }
+    out.close();
+    std::cout << job.prefix << ": " << engine.size() << " spectra, " << evaluations << " evaluations." << std::endl;
+    return;
+  }
+
+  if (engine.size() > 1) {
+    AsyncSpectrumWriter out(job.prefix, job.layout, job.precision, job.backend);
+    try {
+      engine.run(out.sink());
+    } catch (const std::exception &e) {
+      std::cout << job.prefix << ": sweep failed: " << e.what() << std::endl;
+      exit(1);
+    }
+    out.close();
+    std::cout << job.prefix << ": " << engine.size() << " spectra." << std::endl;
+    return;
+  }
+
+  const SweepPoint point = engine.point(0);
+
+  // Effective size (diameter) to calculate size-dependent dielectric function.
+  const double D_SD = diameter(point.L, point.H);
+  std::cout << "Effective size to calculate size-dependent dielectric function = " << D_SD << " nm." << std::endl;
+
+  // Shape coefficients are computed once for the whole spectrum.
+  const PrismModel prism(point.L, point.H, point.R);
+
+  const int wl_n = engine.wavelengths();
+  const double *wl = engine.lambda();
+  std::vector<std::complex<double> > eps_m(wl_n), alpha(wl_n);
+  std::vector<double> alpha_re(wl_n), alpha_im(wl_n), c_sca(wl_n), c_ext(wl_n), c_abs(wl_n);
+  const DielectricCache eps_bulk(point.is_silver, wl_n, wl);
+  for (int i = 0; i < wl_n; ++i)
+    eps_m[i] = eps_bulk.sizeDependent(i, D_SD);
+  prism.spectrum(wl_n, wl, eps_m.data(), point.eps_h, alpha.data(), c_sca.data(), c_ext.data(), c_abs.data());
+  for (int i = 0; i < wl_n; ++i) {
+    alpha_re[i] = std::real(alpha[i]);
+    alpha_im[i] = std::imag(alpha[i]);
+  }
+
+  SpectrumWriter out(job.prefix, job.layout, job.precision, job.backend);
+  out.write(point, wl_n, wl, alpha_re.data(), alpha_im.data(), c_sca.data(), c_ext.data(), c_abs.data());
+  out.close();
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Plasmon resonances of all points of the sweep of a job in its wavelength range, written as text columns to
+  <prefix>-resonance.dat. The points are processed in blocks, so the memory does not grow with the sweep.
+----------------------------------------------------------------------------------------------------------------------*/
+void runResonances(
+  const Job &job)                           // Parameters of the job.
+{
+  const SweepSpec &s = job.sweep;
+  SweepEngine engine(s);
+  const long long num = engine.size();
+  const int block = 1 << 14;
+  const int precision = (job.precision > 0) ? job.precision : 17;
+
+  OutputFile out;
+  out.open(job.prefix + "-resonance.dat", 1 << 20, job.backend);
+  out.put("# material L(nm) H(nm) R(nm) eps_h lambda(nm) C_sca(cm^2) C_ext(cm^2) C_abs(cm^2) FWHM(nm)\n");
+  std::vector<SweepPoint> points;
+  std::vector<Resonance> res(block);
+  for (long long first = 0; first < num; first += block) {
+    points.clear();
+    for (long long i = first; i < std::min(first + block, num); ++i) points.push_back(engine.point(i));
+    resonanceBatch((int)points.size(), points.data(), s.wl_min, s.wl_max, res.data(), s.threads);
+    for (size_t k = 0; k < points.size(); ++k) {
+      const SweepPoint &p = points[k];
+      const double values[] = {p.L, p.H, p.R, p.eps_h, res[k].lambda, res[k].c_sca, res[k].c_ext, res[k].c_abs,
+                               res[k].fwhm};
+      out.put(p.is_silver ? "Ag" : "Au");
+      for (size_t v = 0; v < sizeof(values)/sizeof(values[0]); ++v) {
+        out.put(' ');
+        out.put(values[v], precision);
+      }
+      out.put('\n');
+    }
+  }
+  out.close();
+  std::cout << job.prefix << ": " << num << " resonances." << std::endl;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Fits the measured spectra of a file and writes the parameters to <prefix>-fit.dat. The file has the wavelength
+  in nm in the first column and one spectrum in each further column; # starts a comment. Every point of the sweep
+  of the job is a starting point, and the best fit of each spectrum is kept. The spectra are split between threads.
+----------------------------------------------------------------------------------------------------------------------*/
+void runFit(
+  const Job &job,                           // Parameters of the job.
+  const std::string &name)                  // File with the measured spectra.
+{
+  std::ifstream fin(name.c_str());
+  if (!fin) {
+    std::cout << "Cannot open spectra file " << name << std::endl;
+    exit(1);
+  }
+  std::vector<double> lambda;
+  std::vector<std::vector<double> > spectra;
+  std::string line;
+  for (int line_no = 1; std::getline(fin, line); ++line_no) {
+    size_t hash = line.find('#');
+    if (hash != std::string::npos) line.erase(hash);
+    std::vector<double> row;
+    bool ok = true;
+    for (size_t pos = 0;;) {
+      size_t begin = line.find_first_not_of(" \t\r,", pos);
+      if (begin == std::string::npos) break;
+      size_t end = line.find_first_of(" \t\r,", begin);
+      double x;
+      ok = ok && parseNumber(line.substr(begin, (end == std::string::npos) ? std::string::npos : end - begin), x);
+      row.push_back(x);
+      pos = end;
+    }
+    if (row.empty()) continue;
+    if (spectra.empty()) spectra.resize(row.size() - 1);
+    if (!ok || (row.size() < 2) || (row.size() != spectra.size() + 1)
+        || (!lambda.empty() && !(row[0] > lambda.back()))) {
+      std::cout << name << ":" << line_no << ": expected increasing wavelength and " << spectra.size()
+                << " values" << std::endl;
+      exit(1);
+    }
+    lambda.push_back(row[0]);
+    for (size_t k = 0; k < spectra.size(); ++k) spectra[k].push_back(row[k + 1]);
+  }
+  if (lambda.size() < 2) {
+    std::cout << name << ": no spectra" << std::endl;
+    exit(1);
+  }
+
+  const int n = (int)lambda.size(), num = (int)spectra.size();
+  SweepEngine engine(job.sweep);
+  std::vector<std::unique_ptr<ExtinctionFitter> > fitters(2);
+  for (long long i = 0; i < engine.size(); ++i) {
+    std::unique_ptr<ExtinctionFitter> &f = fitters[engine.point(i).is_silver ? 0 : 1];
+    if (!f) f.reset(new ExtinctionFitter(engine.point(i).is_silver, n, lambda.data()));
+  }
+  const bool free[FIT_PARAMS] = {true, true, true, job.fit_eps_h, job.fit_scale};
+
+  std::vector<FitResult> best(num);
+  std::vector<int> best_silver(num);
+  auto work = [&](const int &first, const int &last) {
+    std::unique_ptr<ExtinctionFitter> own[2];  // The fitters hold work arrays: a copy per thread.
+    for (int m = 0; m < 2; ++m)
+      if (fitters[m]) own[m].reset(new ExtinctionFitter(*fitters[m]));
+    for (int k = first; k < last; ++k) {
+      best[k].rms = INFINITY;
+      for (long long i = 0; i < engine.size(); ++i) {
+        const SweepPoint p = engine.point(i);
+        const double p0[FIT_PARAMS] = {p.L, p.H, p.R, p.eps_h, 1.0};
+        FitResult r = own[p.is_silver ? 0 : 1]->fit(spectra[k].data(), p0, free);
+        if (r.rms < best[k].rms) {
+          best[k] = r;
+          best_silver[k] = p.is_silver;
+        }
+      }
+    }
+  };
+  int threads = (job.sweep.threads > 0) ? job.sweep.threads : (int)std::thread::hardware_concurrency();
+  threads = std::max(std::min(threads, num), 1);
+  std::vector<std::thread> pool;
+  for (int t = 1; t < threads; ++t)
+    pool.push_back(std::thread(work, (int)((long long)num*t/threads), (int)((long long)num*(t + 1)/threads)));
+  work(0, (int)((long long)num/threads));
+  for (size_t t = 0; t < pool.size(); ++t) pool[t].join();
+
+  OutputFile out;
+  out.open(job.prefix + "-fit.dat", 1 << 20, job.backend);
+  out.put("# spectrum material L(nm) H(nm) R(nm) eps_h scale rms iterations converged\n");
+  for (int k = 0; k < num; ++k) {
+    const FitResult &r = best[k];
+    out.put((double)(k + 1), 0);
+    out.put(best_silver[k] ? " Ag" : " Au");
+    for (int j = 0; j < FIT_PARAMS; ++j) {
+      out.put(' ');
+      out.put(r.p[j], job.precision);
+    }
+    out.put(' ');
+    out.put(r.rms, job.precision);
+    out.put(' ');
+    out.put((double)r.iterations, 0);
+    out.put(r.converged ? " 1\n" : " 0\n");
+  }
+  out.close();
+  std::cout << job.prefix << ": " << num << " spectra fitted from " << engine.size() << " starting points."
+            << std::endl;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Spectra of the cross sections of the points of a job with their derivatives by L, H, R, eps_h and lambda,
+  written as text columns to <prefix>-gradient.dat, with a "# point" line before each spectrum of a sweep.
+----------------------------------------------------------------------------------------------------------------------*/
+void runGradient(
+  const Job &job)                           // Parameters of the job.
+{
+  SweepEngine engine(job.sweep);
+  const int wl_n = engine.wavelengths();
+  const double *wl = engine.lambda();
+
+  OutputFile out;
+  out.open(job.prefix + "-gradient.dat", 1 << 20, job.backend);
+  out.put("# lambda(nm) C_ext(cm^2) dC_ext/dL dC_ext/dH dC_ext/dR dC_ext/deps_h dC_ext/dlambda"
+          " C_sca(cm^2) dC_sca/dL dC_sca/dH dC_sca/dR dC_sca/deps_h dC_sca/dlambda\n");
+  for (long long k = 0; k < engine.size(); ++k) {
+    const SweepPoint p = engine.point(k);
+    if (engine.size() > 1) {
+      out.put("\n# point ");
+      out.put((double)k, 0);
+      out.put(p.is_silver ? " Ag L " : " Au L ");
+      out.put(p.L, 0);
+      out.put(" H ");
+      out.put(p.H, 0);
+      out.put(" R ");
+      out.put(p.R, 0);
+      out.put(" eps_h ");
+      out.put(p.eps_h, 0);
+      out.put('\n');
+    }
+    TableCursor cursor;
+    for (int i = 0; i < wl_n; ++i) {
+      GradientDual c[2];
+      crossSectionGradient(wl[i], p.L, p.H, p.R, p.eps_h, p.is_silver, cursor, c[1], c[0]);
+      out.put(wl[i], job.precision);
+      for (int j = 0; j < 2; ++j) {
+        out.put(' ');
+        out.put(c[j].v, job.precision);
+        for (int v = 0; v < GRAD_VARS; ++v) {
+          out.put(' ');
+          out.put(c[j].d[v], job.precision);
+        }
+      }
+      out.put('\n');
+    }
+  }
+  out.close();
+  std::cout << job.prefix << ": " << engine.size() << " gradient spectra." << std::endl;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Ensemble spectra: every point of the sweep of the job, with the distributed axes taken from their distributions,
+  gives the mean cross sections of an ensemble, written as text columns to <prefix>-ensemble.dat with a "# point"
+  line before each spectrum.
+----------------------------------------------------------------------------------------------------------------------*/
+void runEnsemble(
+  const Job &job)                           // Parameters of the job.
+{
+  SweepSpec s = job.sweep;
+  SweepAxis *axis[3] = {&s.L, &s.H, &s.R};
+  for (int j = 0; j < 3; ++j)
+    if (job.dist[j].type != DIST_FIXED) *axis[j] = {0.0, 0.0, 1};
+  SweepEngine engine(s);
+  const int wl_n = engine.wavelengths();
+  std::unique_ptr<DielectricCache> eps[2];
+
+  OutputFile out;
+  out.open(job.prefix + "-ensemble.dat", 1 << 20, job.backend);
+  out.put("# lambda(nm) C_sca(cm^2) C_ext(cm^2) C_abs(cm^2)\n");
+  long long nodes = 0;
+  for (long long k = 0; k < engine.size(); ++k) {
+    const SweepPoint p = engine.point(k);
+    const double value[3] = {p.L, p.H, p.R};
+    SizeDistribution dist[3];
+    for (int j = 0; j < 3; ++j) {
+      dist[j] = job.dist[j];
+      if (dist[j].type == DIST_FIXED) dist[j].mean = value[j];
+    }
+    std::unique_ptr<DielectricCache> &e = eps[p.is_silver ? 0 : 1];
+    if (!e) e.reset(new DielectricCache(p.is_silver, wl_n, engine.lambda()));
+    EnsembleSpectrum r = ensembleSpectrum(*e, dist[0], dist[1], dist[2], p.eps_h, job.nodes);
+    nodes += r.nodes;
+
+    out.put("\n# point ");
+    out.put((double)k, 0);
+    out.put(p.is_silver ? " Ag" : " Au");
+    const char *names[3] = {" L ", " H ", " R "};
+    for (int j = 0; j < 3; ++j) {
+      if (dist[j].type != DIST_FIXED) continue;
+      out.put(names[j]);
+      out.put(value[j], 0);
+    }
+    out.put(" eps_h ");
+    out.put(p.eps_h, 0);
+    out.put(" nodes ");
+    out.put((double)r.nodes, 0);
+    out.put('\n');
+    for (int i = 0; i < wl_n; ++i) {
+      out.put(engine.lambda()[i], job.precision);
+      out.put(' ');
+      out.put(r.c_sca[i], job.precision);
+      out.put(' ');
+      out.put(r.c_ext[i], job.precision);
+      out.put(' ');
+      out.put(r.c_abs[i], job.precision);
+      out.put('\n');
+    }
+  }
+  out.close();
+  std::cout << job.prefix << ": " << engine.size() << " ensemble spectra of " << nodes << " particles." << std::endl;
+}
+
+
+void printUsage()
+{
+  std::cout <<
+    "Usage: triangle [key=value ...] [--jobs FILE | --stream | --stream-binary] [--batch N]\n"
+    "       triangle [key=value ...] [--jobs FILE] --resonance | --gradient | --ensemble\n"
+    "       triangle --fit FILE [L=, H=, R=, eps_h=, material= starting points] [fit_eps_h=1] [fit_scale=0]\n"
+    "       triangle --server SOCKET [--batch N] [wl=...]\n"
+    "       triangle --client SOCKET [--connections C] [--requests N] [--query spectrum|resonance]\n"
+    "       triangle --benchmark-output [N]\n"
+    "       triangle --self-test\n"
+    "  L=, H=, R=       edge length, thickness, corner radius in nm: value or min:max:n\n"
+    "  eps_h=           permittivity of host media: value or min:max:n\n"
+    "  material=        ag | au | both\n"
+    "  wl=              wavelength grid min:max:step in nm (or wl_min=, wl_max=, wl_step=)\n"
+    "  out=             beginning of the output file names\n"
+    "  layout=          columns | legacy | binary\n"
+    "  backend=         stdio | pwrite | uring\n"
+    "  precision=       significant digits of text output, 1..17 (17 round-trips), 0 - shortest exact round trip\n"
+    "  threads=, chunk= sweep worker threads and points per work item, 0 - default\n"
+    "  memory=          megabytes of sweep results held for in-order output, 0 - default (64)\n"
+    "  adaptive=        sample the wavelengths adaptively in the range of wl= to this relative tolerance\n"
+    "  fit_eps_h=, fit_scale=  also fit eps_h (0), the scale of the measured spectra (1)\n"
+    "  dist_L=, dist_H=, dist_R=  size distribution of an ensemble: normal:MEAN:SD, lognormal:MEAN:SD or\n"
+    "                   histogram:X1:W1:X2:W2:... in nm, instead of the value of L=, H=, R=\n"
+    "  nodes=           Gauss-Hermite nodes of a normal or lognormal distribution (8)\n"
+    "  --jobs FILE      run the jobs of FILE, one line of key=value per job, with the above as defaults\n"
+    "  --stream         read \"L H R ag|au [eps_h]\" lines from stdin, write spectra to stdout\n"
+    "  --stream-binary  the same with ResultRecord input (see triangle_result.h)\n"
+    "  --fit FILE       fit L, H, R of measured spectra (columns lambda y1 y2 ...), starting from the sweep points\n"
+    "  --gradient       cross sections with their derivatives by L, H, R, eps_h and lambda instead of spectra\n"
+    "  --ensemble       number-weighted mean cross sections over the size distributions instead of spectra\n"
+    "  --resonance      plasmon resonances of the sweep points in the wavelength range instead of spectra\n"
+    "  --batch N        maximal number of particles evaluated together in streaming and server modes (64)\n"
+    "  --server SOCKET  answer queries of the protocol of triangle_result.h on a Unix domain socket\n"
+    "  --client SOCKET  load generator: C connections (8) sending N requests each (2000), reports latency\n"
+    "  --benchmark-output [N]  compare the output paths on N spectra\n"
+    "  --self-test      check the SIMD kernels of every level the CPU supports against the scalar functions\n"
+    "Without parameters the example nanoprism L=50 H=20 R=2 in vacuum is computed." << std::endl;
+}
+
+
+/***********************************************************************************************************************
+  Streaming mode: particles are read from stdin and their spectra written to stdout as they come.
+
+  Input records are either text lines "L H R material [eps_h]" with the material ag or au (eps_h defaults to the
+  eps_h= parameter, # starts a comment), or binary ResultRecord structures of triangle_result.h. The output is the
+  text columns layout, with a "# point" line before each spectrum, or with layout=binary a result file stream
+  (see triangle_result.h). Records are taken in micro-batches of what has already arrived, up to a limit, so the
+  memory is bounded and a slow producer still gets each result without waiting for a full batch.
+***********************************************************************************************************************/
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Reader of records from a file descriptor through a buffer, able to tell whether more input is ready without
+  blocking.
+----------------------------------------------------------------------------------------------------------------------*/
+class StreamReader
+{
+public:
+
+  explicit StreamReader(
+    const int &fd)                          // File descriptor, e.g. 0 for stdin.
+    : fd_(fd), buf_(1 << 16), begin_(0), end_(0), eof_(false) {}
+
+  // Next line without the end of line; returns false at the end of input or, if block is false, when no complete
+  // line has arrived yet.
+  bool line(
+    std::string &str,                       // Output: line.
+    const bool &block)                      // Wait for input.
+  {
+    for (;;) {
+      const char *nl = (const char *)memchr(&buf_[begin_], '\n', end_ - begin_);
+      if (nl != NULL) {
+        size_t len = nl - &buf_[begin_];
+        str.assign(&buf_[begin_], len);
+        begin_ += len + 1;
+        return true;
+      }
+      if (eof_) {
+        if (begin_ == end_) return false;
+        str.assign(&buf_[begin_], end_ - begin_);
+        begin_ = end_;
+        return true;
+      }
+      if (!fill(block)) return false;
+    }
+  }
+
+  // Next len bytes; returns false at the end of input or, if block is false, when they have not arrived yet.
+  bool bytes(
+    void *data,                             // Output: bytes.
+    const size_t &len,                      // Number of bytes.
+    const bool &block)                      // Wait for input.
+  {
+    while (end_ - begin_ < len) {
+      if (eof_) {
+        if (begin_ != end_) std::cerr << "Incomplete record at the end of input" << std::endl;
+        begin_ = end_;
+        return false;
+      }
+      if (!fill(block)) return false;
+    }
+    memcpy(data, &buf_[begin_], len);
+    begin_ += len;
+    return true;
+  }
+
+private:
+
+  int fd_;                                  // Input.
+  std::vector<char> buf_;                   // Buffer.
+  size_t begin_, end_;                      // Unread bytes.
+  bool eof_;                                // End of input reached.
+
+  // Reads what is available; returns false if block is false and nothing is ready.
+  bool fill(
+    const bool &block)                      // Wait for input.
+  {
+    if (!block) {
+      pollfd p = {fd_, POLLIN, 0};
+      if (poll(&p, 1, 0) <= 0) return false;
+    }
+    if (begin_ > 0) {
+      memmove(&buf_[0], &buf_[begin_], end_ - begin_);
+      end_ -= begin_;
+      begin_ = 0;
+    }
+    if (end_ == buf_.size()) buf_.resize(2*buf_.size());
+    ssize_t r;
+    do r = read(fd_, &buf_[end_], buf_.size() - end_); while ((r < 0) && (errno == EINTR));
+    if (r <= 0)
+      eof_ = true;
+    else
+      end_ += r;
+    return true;
+  }
+};
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Spectra of a micro-batch of particles on a fixed wavelength grid. Particles of the same material and host media
+  are evaluated together: the size-dependent permittivity of all of them on the whole grid at once, then the
+  cross sections wavelength by wavelength with the particles spread over SIMD lanes.
+----------------------------------------------------------------------------------------------------------------------*/
+class BatchEvaluator
+{
+public:
+
+  BatchEvaluator(
+    const int &n,                           // Number of wavelength points.
+    const double lambda[])                  // Wavelengths in nm.
+    : lambda_(lambda, lambda + n), ag_(true, n, lambda), au_(false, n, lambda) {}
+
+  int wavelengths() const { return (int)lambda_.size(); }
+  const double *lambda() const { return lambda_.data(); }
+
+  // Spectra of the particles; the spectrum of particle k starts at out[5*n*k] and holds Re(alpha), Im(alpha),
+  // C_sca, C_ext, C_abs, n values each.
+  void evaluate(
+    const std::vector<SweepPoint> &points,  // Particles.
+    std::vector<double> &out);              // Output: spectra.
+
+private:
+
+  std::vector<double> lambda_;              // Wavelength grid.
+  DielectricCache ag_, au_;                 // Bulk permittivity on the grid.
+
+  // Work arrays of a group of particles.
+  std::vector<int> order_, group_;
+  std::vector<double> L_, H_, R_, D_, eps_re_, eps_im_, e_re_, e_im_, res_[5];
+};
+
+
+void BatchEvaluator::evaluate(
+  const std::vector<SweepPoint> &points,    // Particles.
+  std::vector<double> &out)                 // Output: spectra.
+{
+  const int n = wavelengths();
+  const int m = (int)points.size();
+  out.resize((size_t)5*n*m);
+
+  order_.resize(m);
+  for (int k = 0; k < m; ++k) order_[k] = k;
+  std::sort(order_.begin(), order_.end(), [&](const int &a, const int &b) {
+    if (points[a].is_silver != points[b].is_silver) return points[a].is_silver;
+    return points[a].eps_h < points[b].eps_h;
+  });
+
+  for (int first = 0; first < m;) {
+    const SweepPoint &p0 = points[order_[first]];
+    int last = first + 1;
+    while ((last < m) && (points[order_[last]].is_silver == p0.is_silver)
+           && (points[order_[last]].eps_h == p0.eps_h)) ++last;
+    const int g = last - first;
+
+    group_.assign(order_.begin() + first, order_.begin() + last);
+    L_.resize(g);  H_.resize(g);  R_.resize(g);  D_.resize(g);
+    for (int j = 0; j < g; ++j) {
+      const SweepPoint &p = points[group_[j]];
+      L_[j] = p.L;  H_[j] = p.H;  R_[j] = p.R;
+      D_[j] = diameter(p.L, p.H);
+    }
+    eps_re_.resize((size_t)n*g);
+    eps_im_.resize((size_t)n*g);
+    (p0.is_silver ? ag_ : au_).sizeDependentBatch(g, D_.data(), eps_re_.data(), eps_im_.data());
+
+    e_re_.resize(g);
+    e_im_.resize(g);
+    for (int c = 0; c < 5; ++c) res_[c].resize(g);
+    for (int i = 0; i < n; ++i) {
+      for (int j = 0; j < g; ++j) {
+        e_re_[j] = eps_re_[(size_t)j*n + i];
+        e_im_[j] = eps_im_[(size_t)j*n + i];
+      }
+      particleCrossSections(g, L_.data(), H_.data(), R_.data(), lambda_[i], e_re_.data(), e_im_.data(), p0.eps_h,
+                            res_[0].data(), res_[1].data(), res_[2].data(), res_[3].data(), res_[4].data());
+      for (int j = 0; j < g; ++j) {
+        double *dst = out.data() + (size_t)5*n*group_[j];
+        for (int c = 0; c < 5; ++c) dst[c*n + i] = res_[c][j];
+      }
+    }
+    first = last;
+  }
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Whether a particle from outside is within the range of the model: positive sizes below 10 um and a positive
+  finite host permittivity (NaN fails every comparison).
+----------------------------------------------------------------------------------------------------------------------*/
+bool validParticle(
+  const SweepPoint &p)                      // Particle.
+{
+  return (p.L > 0.0) && (p.H > 0.0) && (p.R > 0.0) && (p.L < 1.0e4) && (p.H < 1.0e4) && (p.R < 1.0e4)
+    && std::isfinite(p.eps_h) && (p.eps_h > 0.0);
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Parses a text input record; returns false for an empty or comment line, stops the program on a bad one.
+----------------------------------------------------------------------------------------------------------------------*/
+bool parseStreamLine(
+  std::string line,                         // Line.
+  const long long &line_no,                 // Number of the line, for messages.
+  const double &eps_h,                      // Host media permittivity if not given.
+  SweepPoint &p)                            // Output: particle.
+{
+  size_t hash = line.find('#');
+  if (hash != std::string::npos) line.erase(hash);
+
+  std::string field[6];
+  int num = 0;
+  for (size_t pos = 0; num < 6;) {
+    size_t begin = line.find_first_not_of(" \t\r,", pos);
+    if (begin == std::string::npos) break;
+    size_t end = line.find_first_of(" \t\r,", begin);
+    field[num++] = line.substr(begin, (end == std::string::npos) ? std::string::npos : end - begin);
+    pos = end;
+  }
+  if (num == 0) return false;
+
+  p.eps_h = eps_h;
+  bool ok = ((num == 4) || (num == 5)) && parseNumber(field[0], p.L) && parseNumber(field[1], p.H)
+    && parseNumber(field[2], p.R) && ((field[3] == "ag") || (field[3] == "au"))
+    && ((num == 4) || parseNumber(field[4], p.eps_h));
+  if (ok && !validParticle(p)) {
+    std::cerr << "stdin:" << line_no << ": L, H, R must be in (0, 1e4) nm and eps_h positive" << std::endl;
+    exit(1);
+  }
+  if (!ok) {
+    std::cerr << "stdin:" << line_no << ": expected \"L H R ag|au [eps_h]\"" << std::endl;
+    exit(1);
+  }
+  p.is_silver = (field[3] == "ag");
+  return true;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Runs the streaming mode until the end of stdin.
+----------------------------------------------------------------------------------------------------------------------*/
+void runStream(
+  const Job &job,                           // Wavelength grid, eps_h default, layout and precision.
+  const bool &binary_input,                 // Input records are ResultRecord structures.
+  const int &max_batch)                     // Maximal number of particles in a micro-batch.
+{
+  const SweepSpec &s = job.sweep;
+  const std::vector<double> wl = SweepEngine::grid(s);
+  const int wl_n = (int)wl.size();
+  BatchEvaluator evaluator(wl_n, wl.data());
+
+  StreamReader in(0);
+  SpectrumWriter out(stdout, job.layout, job.precision);
+  std::vector<SweepPoint> points;
+  std::vector<long long> index;
+  std::vector<double> spectra;
+  long long count = 0, line_no = 0;
+  std::string line;
+
+  for (;;) {
+    // The first record of a batch is waited for, the others are taken only if they have already arrived.
+    points.clear();
+    index.clear();
+    while ((int)points.size() < max_batch) {
+      const bool block = points.empty();
+      SweepPoint p;
+      if (binary_input) {
+        ResultRecord r;
+        if (!in.bytes(&r, sizeof(r), block)) break;
+        p.L = r.L;
+        p.H = r.H;
+        p.R = r.R;
+        p.eps_h = r.eps_h;
+        p.is_silver = r.is_silver != 0;
+        if (!validParticle(p)) {
+          std::cerr << "stdin: record " << count + 1 << ": L, H, R must be in (0, 1e4) nm and eps_h positive"
+                    << std::endl;
+          exit(1);
+        }
+        index.push_back(r.index);
+      } else {
+        if (!in.line(line, block)) break;
+        if (!parseStreamLine(line, ++line_no, s.eps_h.min, p)) continue;
+        index.push_back(count);
+      }
+      points.push_back(p);
+      ++count;
+    }
+    if (points.empty()) break;
+
+    evaluator.evaluate(points, spectra);
+    for (size_t k = 0; k < points.size(); ++k) {
+      const double *d = spectra.data() + (size_t)5*wl_n*k;
+      SweepResult r = {index[k], points[k], wl_n, wl.data(), d, d + wl_n, d + 2*wl_n, d + 3*wl_n, d + 4*wl_n};
+      out.write(r);
+    }
+    out.flush();
+  }
+  out.close();
+}
+
+
+/***********************************************************************************************************************
+  Server mode: a long-lived process answering queries of the protocol of triangle_result.h on a Unix domain
+  socket, and a load generator for it.
+***********************************************************************************************************************/
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Sends all bytes to a socket; returns false if the peer has gone.
+----------------------------------------------------------------------------------------------------------------------*/
+bool sendAll(
+  const int &fd,                            // Socket.
+  const void *data,                         // Bytes.
+  size_t len)                               // Number of bytes.
+{
+  const char *p = (const char *)data;
+  while (len > 0) {
+    ssize_t w = send(fd, p, len, MSG_NOSIGNAL);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += w;
+    len -= w;
+  }
+  return true;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Receives exactly len bytes from a socket; returns false at the end of the stream.
+----------------------------------------------------------------------------------------------------------------------*/
+bool recvAll(
+  const int &fd,                            // Socket.
+  void *data,                               // Output: bytes.
+  size_t len)                               // Number of bytes.
+{
+  char *p = (char *)data;
+  while (len > 0) {
+    ssize_t r = recv(fd, p, len, 0);
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (r == 0) return false;
+    p += r;
+    len -= r;
+  }
+  return true;
+}
+
+
+volatile sig_atomic_t server_stop = 0;      // Set by SIGINT and SIGTERM.
+
+extern "C" void serverSignal(int)
+{
+  server_stop = 1;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Query server. One thread polls the listening socket and all connections and reads the requests into a common
+  queue; a connection is dropped from the poll set when its client has closed it and its answers are out. One
+  compute thread takes everything that has queued up, up to a batch limit, evaluates the particles together
+  (spectra by BatchEvaluator, resonances by resonanceBatch) and appends the responses to the output buffer of each
+  connection, sending what the socket takes without blocking. The rest is written by the poll thread as the
+  client reads, so a slow client delays only itself; while too much waits for it, its requests are not read.
+  Under load concurrent requests are thus coalesced into SIMD batches, while a lone request is answered at once.
+  Responses of a connection keep the order of its requests, since the queue is processed in order.
+----------------------------------------------------------------------------------------------------------------------*/
+class QueryServer
+{
+public:
+
+  QueryServer(
+    const std::string &path,                // Socket path.
+    const Job &job,                         // Wavelength grid.
+    const int &max_batch);                  // Maximal number of queries evaluated together.
+
+  // Serves until SIGINT or SIGTERM.
+  void run();
+
+private:
+
+  struct Connection
+  {
+    int fd;                                 // Socket.
+    std::vector<char> in;                   // Bytes of an incomplete request, used by the poll thread only.
+    std::mutex m;                           // Guards the fields below.
+    std::vector<char> out;                  // Responses not yet sent, from out[sent].
+    size_t sent;                            // ...
+    int queued;                             // Number of requests in the queue.
+    bool eof;                               // The client has closed its side.
+    bool failed;                            // The client has gone; nothing more is sent.
+    explicit Connection(const int &f) : fd(f), sent(0), queued(0), eof(false), failed(false) {}
+    ~Connection() { ::close(fd); }
+    size_t pending() const { return out.size() - sent; }
+  };
+
+  struct Pending
+  {
+    std::shared_ptr<Connection> conn;       // Connection to answer.
+    QueryRequest req;                       // Request.
+  };
+
+  std::string path_;                        // Socket path.
+  int wake_[2];                             // Socket pair by which the compute thread wakes the poll thread.
+  std::vector<double> wl_;                  // Wavelength grid.
+  BatchEvaluator evaluator_;                // Spectra of batches.
+  int max_batch_;                           // Maximal batch.
+
+  std::mutex m_;                            // Guards the fields below.
+  std::condition_variable cv_;              // Signals new requests and stop.
+  std::deque<Pending> queue_;               // Requests to process.
+  bool stop_;                               // Stop the compute thread.
+  long long num_batches_, num_queries_;     // Statistics.
+
+  // Reads what has arrived on a connection and queues the complete requests; returns false at the end of the
+  // stream.
+  bool receive(
+    const std::shared_ptr<Connection> &conn);  // Connection.
+
+  // Sends as much of the output of a connection as the socket takes without blocking; conn.m must be held.
+  static void flush(
+    Connection &conn);                      // Connection.
+
+  // Processes batches of requests.
+  void compute();
+};
+
+
+QueryServer::QueryServer(
+  const std::string &path,                  // Socket path.
+  const Job &job,                           // Wavelength grid.
+  const int &max_batch)                     // Maximal number of queries evaluated together.
+  : path_(path), wl_(SweepEngine::grid(job.sweep)), evaluator_((int)wl_.size(), wl_.data()),
+    max_batch_(std::max(max_batch, 1)), stop_(false), num_batches_(0), num_queries_(0) {}
+
+
+bool QueryServer::receive(
+  const std::shared_ptr<Connection> &conn)  // Connection.
+{
+  char buf[64*sizeof(QueryRequest)];
+  bool open = true;
+  for (;;) {
+    ssize_t r = recv(conn->fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if ((r < 0) && (errno == EINTR)) continue;
+    if (r <= 0) {
+      open = (r < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK));
+      break;
+    }
+    conn->in.insert(conn->in.end(), buf, buf + r);
+  }
+
+  size_t num = conn->in.size()/sizeof(QueryRequest);
+  if (num > 0) {
+    {
+      std::lock_guard<std::mutex> lk(conn->m);
+      conn->queued += (int)num;
+    }
+    {
+      std::lock_guard<std::mutex> lk(m_);
+      for (size_t q = 0; q < num; ++q) {
+        Pending p;
+        p.conn = conn;
+        memcpy(&p.req, conn->in.data() + q*sizeof(QueryRequest), sizeof(QueryRequest));
+        queue_.push_back(p);
+      }
+    }
+    cv_.notify_one();
+    conn->in.erase(conn->in.begin(), conn->in.begin() + num*sizeof(QueryRequest));
+  }
+  return open;
+}
+
+
+void QueryServer::flush(
+  Connection &conn)                         // Connection.
+{
+  while (!conn.failed && (conn.pending() > 0)) {
+    ssize_t w = send(conn.fd, conn.out.data() + conn.sent, conn.pending(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+      conn.failed = true;
+      break;
+    }
+    conn.sent += w;
+  }
+  if (conn.failed || (conn.pending() == 0)) {
+    conn.out.clear();
+    conn.sent = 0;
+  }
+}
+
+
+void QueryServer::compute()
+{
+  const int n = (int)wl_.size();
+  std::vector<Pending> batch;
+  std::vector<SweepPoint> points, peaks;    // Particles of the spectrum and of the resonance queries.
+  std::vector<int> slot;                    // Index in points or peaks of each query, -1 if none.
+  std::vector<double> spectra;
+  std::vector<Resonance> resonances;
+  std::vector<std::pair<Connection *, std::vector<char> > > out;
+  std::vector<int> answered;                // Number of responses in out[c].
+
+  for (;;) {
+    batch.clear();
+    {
+      std::unique_lock<std::mutex> lk(m_);
+      cv_.wait(lk, [&] { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) return;
+      while (!queue_.empty() && ((int)batch.size() < max_batch_)) {
+        batch.push_back(queue_.front());
+        queue_.pop_front();
+      }
+      ++num_batches_;
+      num_queries_ += batch.size();
+    }
+
+    points.clear();
+    peaks.clear();
+    slot.assign(batch.size(), -1);
+    for (size_t q = 0; q < batch.size(); ++q) {
+      const QueryRequest &r = batch[q].req;
+      SweepPoint p = {r.L, r.H, r.R, r.eps_h, r.is_silver != 0};
+      if (((r.type == QUERY_SPECTRUM) || (r.type == QUERY_RESONANCE)) && validParticle(p)) {
+        std::vector<SweepPoint> &v = (r.type == QUERY_SPECTRUM) ? points : peaks;
+        slot[q] = (int)v.size();
+        v.push_back(p);
+      }
+    }
+    if (!points.empty()) evaluator_.evaluate(points, spectra);
+    if (!peaks.empty()) {
+      resonances.resize(peaks.size());
+      resonanceBatch((int)peaks.size(), peaks.data(), wl_.front(), wl_.back(), resonances.data());
+    }
+
+    // Responses, gathered per connection in the order of the requests.
+    out.clear();
+    answered.clear();
+    for (size_t q = 0; q < batch.size(); ++q) {
+      const QueryRequest &r = batch[q].req;
+      size_t c = 0;
+      while ((c < out.size()) && (out[c].first != batch[q].conn.get())) ++c;
+      if (c == out.size()) {
+        out.push_back(std::make_pair(batch[q].conn.get(), std::vector<char>()));
+        answered.push_back(0);
+      }
+      std::vector<char> &buf = out[c].second;
+      ++answered[c];
+
+      QueryResponse resp = {r.id, QUERY_OK, 0};
+      const double *values = NULL;
+      double res[RESONANCE_VALUES];
+      if (r.type == QUERY_GRID) {
+        resp.num_values = n;
+        values = wl_.data();
+      } else if (slot[q] < 0) {
+        resp.status = QUERY_BAD_REQUEST;
+      } else if (r.type == QUERY_SPECTRUM) {
+        resp.num_values = 5*n;
+        values = spectra.data() + (size_t)5*n*slot[q];
+      } else {
+        const Resonance &p = resonances[slot[q]];
+        res[RESONANCE_LAMBDA] = p.lambda;
+        res[RESONANCE_C_SCA] = p.c_sca;
+        res[RESONANCE_C_EXT] = p.c_ext;
+        res[RESONANCE_C_ABS] = p.c_abs;
+        res[RESONANCE_FWHM] = p.fwhm;
+        resp.num_values = RESONANCE_VALUES;
+        values = res;
+      }
+      const char *h = (const char *)&resp;
+      buf.insert(buf.end(), h, h + sizeof(resp));
+      if (values != NULL) buf.insert(buf.end(), (const char *)values, (const char *)(values + resp.num_values));
+    }
+
+    // The poll thread is woken to write what the sockets did not take and to drop connections that are done.
+    bool wake = false;
+    for (size_t c = 0; c < out.size(); ++c) {
+      Connection &conn = *out[c].first;
+      std::lock_guard<std::mutex> lk(conn.m);
+      conn.queued -= answered[c];
+      if (!conn.failed) {
+        conn.out.insert(conn.out.end(), out[c].second.begin(), out[c].second.end());
+        flush(conn);
+      }
+      wake = wake || (conn.pending() > 0) || (conn.eof && (conn.queued == 0)) || conn.failed;
+    }
+    if (wake) send(wake_[1], "", 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+  }
+}
+
+
+void QueryServer::run()
+{
+  int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if ((lfd < 0) || (path_.size() >= sizeof(addr.sun_path))) {
+    std::cout << "Cannot create socket " << path_ << std::endl;
+    exit(1);
+  }
+  memcpy(addr.sun_path, path_.c_str(), path_.size());
+  unlink(path_.c_str());
+  if ((bind(lfd, (sockaddr *)&addr, sizeof(addr)) != 0) || (listen(lfd, 64) != 0)
+      || (socketpair(AF_UNIX, SOCK_STREAM, 0, wake_) != 0)) {
+    std::cout << "Cannot listen on " << path_ << ": " << strerror(errno) << std::endl;
+    exit(1);
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = serverSignal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  std::cout << "Serving on " << path_ << ", " << wl_.size() << " wavelengths." << std::endl;
+
+  // Until a signal: read requests and write what the compute thread could not send. Then stop reading, answer
+  // what has been read, and give the clients a second to take the answers. The listening socket and the wake
+  // socket come first in the poll set, then the connections in the order of conns.
+  const size_t max_pending = 1 << 22;       // Requests of a connection are not read while more bytes wait.
+  std::thread worker(&QueryServer::compute, this);
+  std::vector<std::shared_ptr<Connection> > conns;
+  std::vector<pollfd> fds;
+  bool reading = true;
+  std::chrono::steady_clock::time_point deadline;
+  for (;;) {
+    if (reading && server_stop) {
+      reading = false;
+      {
+        std::lock_guard<std::mutex> lk(m_);
+        stop_ = true;
+      }
+      cv_.notify_one();
+      worker.join();
+      deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    }
+    if (!reading && (conns.empty() || (std::chrono::steady_clock::now() > deadline))) break;
+
+    fds.resize(conns.size() + 2);
+    fds[0] = pollfd{reading ? lfd : -1, POLLIN, 0};
+    fds[1] = pollfd{wake_[0], POLLIN, 0};
+    for (size_t c = 0; c < conns.size(); ++c) {
+      std::lock_guard<std::mutex> lk(conns[c]->m);
+      size_t pending = conns[c]->pending();
+      short events = (reading && !conns[c]->eof && (pending < max_pending)) ? POLLIN : 0;
+      fds[c + 2] = pollfd{conns[c]->fd, (short)(events | ((pending > 0) ? POLLOUT : 0)), 0};
+    }
+    poll(fds.data(), fds.size(), reading ? 200 : 20);
+
+    char buf[64];
+    if (fds[1].revents & POLLIN)
+      while (recv(wake_[0], buf, sizeof(buf), MSG_DONTWAIT) > 0) {}
+
+    // A connection leaves the poll set when the client has gone, or has closed its side and has all its answers.
+    size_t kept = 0;
+    for (size_t c = 0; c < conns.size(); ++c) {
+      Connection &conn = *conns[c];
+      const short ev = fds[c + 2].revents;
+      const bool eof = (ev & (POLLIN | POLLHUP | POLLERR)) && (fds[c + 2].events & POLLIN) && !receive(conns[c]);
+      std::lock_guard<std::mutex> lk(conn.m);
+      conn.eof = conn.eof || eof;
+      conn.failed = conn.failed || (ev & (POLLHUP | POLLERR));  // Closed both ways: no one to answer.
+      if (ev & POLLOUT) flush(conn);
+      if (!(conn.failed || ((conn.eof || !reading) && (conn.queued == 0) && (conn.pending() == 0))))
+        conns[kept++] = conns[c];
+    }
+    conns.resize(kept);
+    if (fds[0].revents & POLLIN) {
+      int fd = accept(lfd, NULL, NULL);
+      if (fd >= 0) conns.push_back(std::make_shared<Connection>(fd));
+    }
+  }
+  conns.clear();
+  ::close(wake_[0]);
+  ::close(wake_[1]);
+  ::close(lfd);
+  unlink(path_.c_str());
+  std::cout << "Served " << num_queries_ << " queries in " << num_batches_ << " batches." << std::endl;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Load generator: each connection sends requests for random particles one after another, waiting for each
+  response, and the latencies of all requests give the percentiles.
+----------------------------------------------------------------------------------------------------------------------*/
+void runClient(
+  const std::string &path,                  // Socket path.
+  const int &connections,                   // Number of concurrent connections.
+  const int &requests,                      // Number of requests per connection.
+  const QueryType &type)                    // Type of the requests.
+{
+  std::vector<std::vector<double> > latency(connections);
+  std::vector<int> failed(connections, 0);
+
+  auto client = [&](const int &c) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if ((fd < 0) || (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0)) {
+      failed[c] = requests;
+      if (fd >= 0) ::close(fd);
+      return;
+    }
+    std::mt19937_64 rng(12345 + c);
+    std::uniform_real_distribution<double> uni(0.0, 1.0);
+    std::vector<double> values;
+    for (int q = 0; q < requests; ++q) {
+      QueryRequest req = {(uint64_t)q, (uint32_t)type, (int32_t)(q & 1), 30.0 + 70.0*uni(rng), 8.0 + 22.0*uni(rng),
+                          1.0 + 4.0*uni(rng), 1.0 + uni(rng)};
+      std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+      QueryResponse resp;
+      if (!sendAll(fd, &req, sizeof(req)) || !recvAll(fd, &resp, sizeof(resp))) {
+        failed[c] += requests - q;
+        break;
+      }
+      values.resize(resp.num_values);
+      if (!recvAll(fd, values.data(), values.size()*sizeof(double))) {
+        failed[c] += requests - q;
+        break;
+      }
+      if ((resp.status != QUERY_OK) || (resp.id != req.id)) ++failed[c];
+      latency[c].push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+    }
+    ::close(fd);
+  };
+
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  std::vector<std::thread> pool;
+  for (int c = 0; c < connections; ++c) pool.push_back(std::thread(client, c));
+  for (int c = 0; c < connections; ++c) pool[c].join();
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  std::vector<double> all;
+  int num_failed = 0;
+  for (int c = 0; c < connections; ++c) {
+    all.insert(all.end(), latency[c].begin(), latency[c].end());
+    num_failed += failed[c];
+  }
+  std::sort(all.begin(), all.end());
+  auto percentile = [&](const double &q) {
+    return all.empty() ? NAN : all[std::min((size_t)(q*all.size()), all.size() - 1)];
+  };
+  char line[200];
+  snprintf(line, sizeof(line), "%d connections, %zu requests in %.3f s: %.0f req/s, latency p50 %.1f us, "
+           "p99 %.1f us, max %.1f us, %d failed", connections, all.size(), seconds, all.size()/seconds,
+           percentile(0.5)*1.0e6, percentile(0.99)*1.0e6, percentile(1.0)*1.0e6, num_failed);
+  std::cout << line << std::endl;
+}
+
+
+/***********************************************************************************************************************
+  Self-test: triangle --self-test runs the batch kernels of every SIMD level the CPU supports, not only the one
+  chosen at run time, against the scalar functions they replace, over silver and gold particles from 10 to 300 nm
+  and wavelengths from 250 to 1200 nm. The largest difference of each kernel is printed with its bound, and the
+  exit status is 1 if a bound is exceeded.
+
+  Differences are counted in units in the last place of the magnitude of the reference value, since the real
+  part of alpha passes through zero at the resonance. The bounds:
+    polarizBatch          - 64 ulp. The kernels run the same operations as PrismModel::polariz and agree bit for
+                            bit unless the compiler contracts a*b + c into fused multiply-adds (AVX-512 code),
+                            whose rounding the nearly cancelling denominator amplifies at the resonance;
+    particleCrossSections - 512 ulp: the shape coefficients come from simdLog/simdExp instead of std::pow;
+    size correction       - 64 ulp against the scalar kernel.
+  The piecewise-cubic tables of the optical constants are checked against interpolate(), with and without a
+  cursor, in ulps of the largest tabulated value: 64 ulp, for the rounding of the coefficients of the cubics.
+  The check extends one table step beyond the ends, as extrapolation further out amplifies that rounding.
+  Numbers written by OutputFile at precisions 0, 6, 17 and 120 must read back exactly as printf formats them.
+***********************************************************************************************************************/
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Distance between two numbers in units in the last place of a scale.
+----------------------------------------------------------------------------------------------------------------------*/
+double ulpDistance(
+  const double &a,                          // Number.
+  const double &b,                          // Reference number.
+  const double &scale)                      // Scale, usually the magnitude of the reference.
+{
+  double s = std::fabs(scale);
+  if (a == b) return 0.0;
+  if (!std::isfinite(a) || !std::isfinite(b)) return INFINITY;
+  return std::fabs(a - b)/(std::nextafter(s, INFINITY) - s);
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Prints the result of a check; returns true if it passed.
+----------------------------------------------------------------------------------------------------------------------*/
+bool reportCheck(
+  const char *name,                         // Checked function.
+  const char *level,                        // SIMD level.
+  const double &ulp,                        // Largest difference in ulp.
+  const double &bound)                      // Allowed difference in ulp.
+{
+  char line[200];
+  snprintf(line, sizeof(line), "%-22s %-8s max %8.1f ulp, bound %5.0f ulp: %s", name, level, ulp, bound,
+           (ulp <= bound) ? "ok" : "FAILED");
+  std::cout << line << std::endl;
+  return ulp <= bound;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Runs the checks; returns the number of failed ones.
+----------------------------------------------------------------------------------------------------------------------*/
+int selfTest()
+{
+  const int widths[] = {0, 2, 4, 8};
+  const char *levels[] = {"scalar", "sse2", "avx2", "avx512"};
+
+  std::vector<double> wl;
+  for (double x = 250.0; x <= 1200.0; x += 0.73) wl.push_back(x);
+  const int n = (int)wl.size();
+  std::vector<double> L, H, R;
+  for (double l = 10.0; l <= 300.0; l *= 1.37)
+    for (double h = 3.0; h <= 60.0; h *= 1.6)
+      for (double r = 0.5; r <= 15.0; r *= 2.1) {
+        L.push_back(l);
+        H.push_back(h);
+        R.push_back(r);
+      }
+  const int m = (int)L.size();
+  const double host[] = {1.0, 1.77, 2.25};
+  const DielectricCache eps[2] = {DielectricCache(true, n, wl.data()), DielectricCache(false, n, wl.data())};
+
+  int failed = 0;
+  std::vector<double> e_re(n), e_im(n), a_re(n), a_im(n), ref_re(n), ref_im(n);
+  std::vector<double> pe_re(m), pe_im(m), pa_re(m), pa_im(m);
+  for (int w = 0; w < 4; ++w) {
+    if (widths[w] > simdWidth()) {
+      std::cout << levels[w] << ": not supported by the CPU, skipped" << std::endl;
+      continue;
+    }
+    const PolarizKernel polariz = polarizKernel(widths[w]);
+    const ParticleKernel particle = particleKernel(widths[w]);
+    const DrudeKernel drude = drudeKernel(widths[w]);
+    double ulp_polariz = 0.0, ulp_particle = 0.0, ulp_drude = 0.0;
+
+    for (int mat = 0; mat < 2; ++mat) {
+      // Over wavelengths: every particle and host against PrismModel::polariz.
+      for (int k = 0; k < m; ++k) {
+        PrismModel prism(L[k], H[k], R[k]);
+        const double D = diameter(L[k], H[k]);
+        for (int i = 0; i < n; ++i) {
+          std::complex<double> e = eps[mat].sizeDependent(i, D);
+          e_re[i] = std::real(e);
+          e_im[i] = std::imag(e);
+        }
+        for (int h = 0; h < 3; ++h) {
+          polariz(n, wl.data(), e_re.data(), e_im.data(), prism.coef(host[h]), a_re.data(), a_im.data());
+          for (int i = 0; i < n; ++i) {
+            std::complex<double> a = prism.polariz(wl[i], std::complex<double>(e_re[i], e_im[i]), host[h]);
+            ulp_polariz = std::max(ulp_polariz, std::max(ulpDistance(a_re[i], std::real(a), std::abs(a)),
+                                                         ulpDistance(a_im[i], std::imag(a), std::abs(a))));
+          }
+        }
+      }
+
+      // Over particles at every 7th wavelength.
+      for (int i = 0; i < n; i += 7) {
+        for (int k = 0; k < m; ++k) {
+          std::complex<double> e = eps[mat].sizeDependent(i, diameter(L[k], H[k]));
+          pe_re[k] = std::real(e);
+          pe_im[k] = std::imag(e);
+        }
+        ParticleBatch b = {m, L.data(), H.data(), R.data(), pe_re.data(), pe_im.data(), wl[i], host[1],
+                           pa_re.data(), pa_im.data(), NULL, NULL, NULL};
+        particle(b);
+        for (int k = 0; k < m; ++k) {
+          PrismModel prism(L[k], H[k], R[k]);
+          std::complex<double> a = prism.polariz(wl[i], std::complex<double>(pe_re[k], pe_im[k]), host[1]);
+          ulp_particle = std::max(ulp_particle, std::max(ulpDistance(pa_re[k], std::real(a), std::abs(a)),
+                                                         ulpDistance(pa_im[k], std::imag(a), std::abs(a))));
+        }
+      }
+
+      // Size correction of the bulk permittivity against the scalar kernel.
+      const DrudeParams &d = eps[mat].drude();
+      std::vector<double> omega(n);
+      for (int i = 0; i < n; ++i) omega[i] = 1239.8/wl[i];
+      for (double gam = 0.02; gam < 2.0; gam *= 3.0) {
+        drude(n, omega.data(), eps[mat].bulkRe(), eps[mat].bulkIm(), d.omega_p*d.omega_p, gam, e_re.data(),
+              e_im.data());
+        drudeKernelScalar(n, omega.data(), eps[mat].bulkRe(), eps[mat].bulkIm(), d.omega_p*d.omega_p, gam,
+                          ref_re.data(), ref_im.data());
+        for (int i = 0; i < n; ++i) {
+          const double scale = std::abs(std::complex<double>(ref_re[i], ref_im[i]));
+          ulp_drude = std::max(ulp_drude, std::max(ulpDistance(e_re[i], ref_re[i], scale),
+                                                   ulpDistance(e_im[i], ref_im[i], scale)));
+        }
+      }
+    }
+
+    failed += !reportCheck("polarizBatch", levels[w], ulp_polariz, 64.0);
+    failed += !reportCheck("particleCrossSections", levels[w], ulp_particle, 512.0);
+    failed += !reportCheck("size correction", levels[w], ulp_drude, 64.0);
+  }
+  // Tables of the optical constants over the tabulated range and one step beyond either end.
+  auto checkTable = [&](const char *name, const int &num, const double x_arr[], const double *const y_arr[2],
+                        void (*eval)(const double &, double [], TableCursor *)) {
+    double scale = 0.0, ulp = 0.0;
+    for (int j = 0; j < num; ++j) scale = std::max(scale, std::max(std::fabs(y_arr[0][j]), std::fabs(y_arr[1][j])));
+    const double lo = 2.0*x_arr[0] - x_arr[1], hi = 2.0*x_arr[num - 1] - x_arr[num - 2];
+    TableCursor cursor;
+    for (int k = 0; k <= 100000; ++k) {
+      const double x = lo + (hi - lo)*k/100000;
+      double y[2], y_cursor[2];
+      eval(x, y, NULL);
+      eval(x, y_cursor, &cursor);
+      for (int c = 0; c < 2; ++c) {
+        const double ref = interpolate(num, x_arr, y_arr[c], x);
+        ulp = std::max(ulp, std::max(ulpDistance(y[c], ref, scale), ulpDistance(y_cursor[c], ref, scale)));
+      }
+    }
+    failed += !reportCheck(name, "", ulp, 64.0);
+  };
+  const double *const ag_nk[2] = {ag_ndata, ag_kdata}, *const au_nk[2] = {au_ndata, au_kdata};
+  checkTable("silver n, k table", ag_num, ag_energy, ag_nk, [](const double &x, double y[], TableCursor *c) {
+    if (c) ag_table.eval(x, y, *c); else ag_table.eval(x, y);
+  });
+  checkTable("gold n, k table", au_num, au_energy, au_nk, [](const double &x, double y[], TableCursor *c) {
+    if (c) au_table.eval(x, y, *c); else au_table.eval(x, y);
+  });
+
+  // Numbers written by OutputFile through a small buffer, so that many straddle its end, read back against
+  // printf at high precisions and exactly in the shortest form.
+  for (const int precision : {0, 6, 17, 120}) {
+    FILE *f = tmpfile();
+    if (f == NULL) {
+      std::cout << "output formatting: cannot create a temporary file" << std::endl;
+      ++failed;
+      break;
+    }
+    std::vector<double> values;
+    std::mt19937_64 rng(precision);
+    for (int k = 0; k < 20000; ++k) {
+      std::uniform_real_distribution<double> mantissa(-1.0, 1.0);
+      std::uniform_int_distribution<int> exponent(-320, 308);
+      values.push_back(mantissa(rng)*std::pow(10.0, exponent(rng)));
+    }
+    OutputFile out;
+    out.attach(f, 100);
+    for (size_t k = 0; k < values.size(); ++k) {
+      out.put(values[k], precision);
+      out.put('\n');
+    }
+    out.close();
+    rewind(f);
+    int wrong = 0;
+    char line[400], ref[400];
+    for (size_t k = 0; k < values.size(); ++k) {
+      if (fgets(line, sizeof(line), f) == NULL) {
+        wrong += (int)(values.size() - k);
+        break;
+      }
+      line[strcspn(line, "\n")] = 0;
+      snprintf(ref, sizeof(ref), "%.*g", precision, values[k]);
+      wrong += (precision > 0) ? (strcmp(line, ref) != 0) : (strtod(line, NULL) != values[k]);
+    }
+    wrong += fgets(line, sizeof(line), f) != NULL;
+    fclose(f);
+    snprintf(line, sizeof(line), "%-22s %-8d %d of %zu numbers wrong: %s", "output formatting", precision, wrong,
+             values.size(), wrong ? "FAILED" : "ok");
+    std::cout << line << std::endl;
+    failed += wrong > 0;
+  }
+
+  std::cout << (failed ? "Self-test FAILED." : "Self-test passed.") << std::endl;
+  return failed;
+}
+
+
+/***********************************************************************************************************************
+  The example program.
+***********************************************************************************************************************/
+
+int main(int argc, char **argv)
+{
+  Job job = defaultJob();
+  const char *job_file = NULL, *fit_file = NULL;
+  bool stream = false, binary_input = false, resonance = false, gradient = false, ensemble = false;
+  const char *server = NULL, *client = NULL;
+  int max_batch = 64, connections = 8, requests = 2000;
+  QueryType query = QUERY_SPECTRUM;
+
+  for (int a = 1; a < argc; ++a) {
+    std::string arg = argv[a];
+    if ((arg == "--help") || (arg == "-h")) {
+      printUsage();
+      return 0;
+    }
+    if (arg == "--self-test") return selfTest() ? 1 : 0;
+    if (arg == "--benchmark-output") {
+      outputBenchmark("benchmark", (a + 1 < argc) ? atoi(argv[a + 1]) : 2000);
+      return 0;
+    }
+    if ((arg == "--stream") || (arg == "--stream-binary")) {
+      stream = true;
+      binary_input = (arg == "--stream-binary");
+      continue;
+    }
+    if ((arg == "--server") || (arg == "--client")) {
+      if (++a == argc) {
+        std::cout << arg << " requires a socket path" << std::endl;
+        return 1;
+      }
+      ((arg == "--server") ? server : client) = argv[a];
+      continue;
+    }
+    if ((arg == "--connections") || (arg == "--requests")) {
+      int &value = (arg == "--connections") ? connections : requests;
+      if ((++a == argc) || !parseNumber(std::string(argv[a]), value) || (value < 1)) {
+        std::cout << arg << " requires a positive number" << std::endl;
+        return 1;
+      }
+      continue;
+    }
+    if (arg == "--query") {
+      std::string q = (++a < argc) ? argv[a] : "";
+      if ((q != "spectrum") && (q != "resonance")) {
+        std::cout << "--query requires spectrum or resonance" << std::endl;
+        return 1;
+      }
+      query = (q == "spectrum") ? QUERY_SPECTRUM : QUERY_RESONANCE;
+      continue;
+    }
+    if ((arg == "--resonance") || (arg == "--gradient") || (arg == "--ensemble")) {
+      ((arg == "--resonance") ? resonance : (arg == "--gradient") ? gradient : ensemble) = true;
+      continue;
+    }
+    if (arg == "--batch") {
+      if ((++a == argc) || !parseNumber(std::string(argv[a]), max_batch) || (max_batch < 1)) {
+        std::cout << "--batch requires a positive number" << std::endl;
+        return 1;
+      }
+      continue;
+    }
+    if ((arg == "--jobs") || (arg == "--fit")) {
+      if (++a == argc) {
+        std::cout << arg << " requires a file name" << std::endl;
+        return 1;
+      }
+      ((arg == "--jobs") ? job_file : fit_file) = argv[a];
+      continue;
+    }
+    std::string error;
+    if (!setJobParam(job, arg, error)) {
+      std::cout << error << std::endl;
+      printUsage();
+      return 1;
+    }
+  }
+
+  if (server != NULL) {
+    QueryServer(server, job, max_batch).run();
+    return 0;
+  }
+  if (client != NULL) {
+    runClient(client, connections, requests, query);
+    return 0;
+  }
+  if (stream) {
+    runStream(job, binary_input, max_batch);
+    return 0;
+  }
+
+  if (fit_file != NULL) {
+    runFit(job, fit_file);
+    return 0;
+  }
+
+  std::vector<Job> jobs = (job_file != NULL) ? readJobFile(job_file, job) : std::vector<Job>(1, job);
+  for (size_t j = 0; j < jobs.size(); ++j)
+    if (resonance)
+      runResonances(jobs[j]);
+    else if (gradient)
+      runGradient(jobs[j]);
+    else if (ensemble)
+      runEnsemble(jobs[j]);
+    else
+      runJob(jobs[j]);
 
   return 0;
 };
@@ -0,0 +1,245 @@
+/*======================================================================================================================
+
+  Binary result format of the triangle code and a memory-mapped reader for it.
+
+  The file consists of
+    - a header (struct ResultHeader) with the sizes, offsets and names of the stored quantities;
+    - the wavelength grid, num_wavelengths doubles in nm;
+    - num_records records of record_size bytes, one per spectrum: struct ResultRecord with the parameters of
+      the particle followed by num_columns columns of num_wavelengths doubles each, in the order
+      Re(alpha), Im(alpha) in nm^3, C_sca, C_ext, C_abs in cm^2.
+  All numbers are in the byte order of the writing machine (see ResultHeader::endian) and every block starts at a
+  multiple of 8 bytes, so the columns can be used in place. Any spectrum is found in O(1) as
+  data_offset + i*record_size. A file whose writer did not finish has num_records = 0, and the number of complete
+  records is then taken from the file size.
+
+  The header also defines the query protocol of the server mode (see QueryRequest).
+
+  The header depends only on the C and POSIX libraries and can be included by downstream tools, e.g.:
+    ResultFile f;
+    if (f.open("analytic_model-spectrum.bin"))
+      for (size_t i = 0; i < f.size(); ++i) use(f.record(i).L, f.column(i, RESULT_C_EXT));
+
+======================================================================================================================*/
+
+#ifndef TRIANGLE_RESULT_H
+#define TRIANGLE_RESULT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Constants of the format.
+----------------------------------------------------------------------------------------------------------------------*/
+const char result_magic[8] = {'T', 'R', 'I', 'A', 'N', 'G', 'L', 'E'};
+const uint32_t result_version = 1;
+const uint32_t result_endian = 0x01020304;  // Reads differently on a machine with the other byte order.
+
+enum ResultColumn { RESULT_ALPHA_RE, RESULT_ALPHA_IM, RESULT_C_SCA, RESULT_C_EXT, RESULT_C_ABS, RESULT_COLUMNS };
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Header of the file, 256 bytes.
+----------------------------------------------------------------------------------------------------------------------*/
+struct ResultHeader
+{
+  char magic[8];                            // result_magic.
+  uint32_t version;                         // result_version.
+  uint32_t endian;                          // result_endian.
+  uint64_t header_size;                     // Size of this header in bytes.
+  uint64_t num_wavelengths;                 // Number of wavelength points.
+  uint64_t num_columns;                     // Number of columns in a record.
+  uint64_t num_records;                     // Number of records, 0 if the writer did not finish.
+  uint64_t record_size;                     // Size of a record in bytes.
+  uint64_t wavelength_offset;               // Offset of the wavelength grid.
+  uint64_t data_offset;                     // Offset of the first record.
+  char column_name[RESULT_COLUMNS][16];     // Names of the columns.
+  char column_unit[RESULT_COLUMNS][8];      // Units of the columns.
+  char reserved[64];                        // Zero.
+};
+
+static_assert(sizeof(ResultHeader) == 256, "ResultHeader must have the same layout on all platforms");
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Parameters of the particle at the beginning of each record, 48 bytes.
+----------------------------------------------------------------------------------------------------------------------*/
+struct ResultRecord
+{
+  int64_t index;                            // Index of the point in the sweep.
+  int32_t is_silver;                        // Material: 1 - silver, 0 - gold.
+  int32_t reserved;                         // Zero.
+  double L;                                 // Edge length in nm.
+  double H;                                 // Thickness in nm.
+  double R;                                 // Triangle base corner radius in nm.
+  double eps_h;                             // Dielectric permittivity of host media.
+};
+
+static_assert(sizeof(ResultRecord) == 48, "ResultRecord must have the same layout on all platforms");
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Header of a file with the given wavelength grid size, with the names and units filled in.
+----------------------------------------------------------------------------------------------------------------------*/
+inline ResultHeader resultHeader(
+  const uint64_t &num_wavelengths)          // Number of wavelength points.
+{
+  static const char names[RESULT_COLUMNS][16] = {"alpha_re", "alpha_im", "c_sca", "c_ext", "c_abs"};
+  static const char units[RESULT_COLUMNS][8] = {"nm^3", "nm^3", "cm^2", "cm^2", "cm^2"};
+
+  ResultHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, result_magic, sizeof(h.magic));
+  h.version = result_version;
+  h.endian = result_endian;
+  h.header_size = sizeof(ResultHeader);
+  h.num_wavelengths = num_wavelengths;
+  h.num_columns = RESULT_COLUMNS;
+  h.record_size = sizeof(ResultRecord) + RESULT_COLUMNS*num_wavelengths*sizeof(double);
+  h.wavelength_offset = sizeof(ResultHeader);
+  h.data_offset = h.wavelength_offset + num_wavelengths*sizeof(double);
+  memcpy(h.column_name, names, sizeof(names));
+  memcpy(h.column_unit, units, sizeof(units));
+  return h;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Read-only view of a result file mapped into memory. Nothing is parsed or copied: the accessors return pointers
+  into the mapping, which stay valid until close() or destruction.
+----------------------------------------------------------------------------------------------------------------------*/
+class ResultFile
+{
+public:
+
+  ResultFile() : base_(NULL), length_(0), header_(NULL), num_records_(0) {}
+  ~ResultFile() { close(); }
+
+  // Maps the file; returns false if it cannot be read or is not a result file of this version and byte order.
+  bool open(
+    const char *name)                       // File name.
+  {
+    close();
+    int fd = ::open(name, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(ResultHeader))) {
+      ::close(fd);
+      return false;
+    }
+    length_ = (size_t)st.st_size;
+    void *p = mmap(NULL, length_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+      length_ = 0;
+      return false;
+    }
+    base_ = (const char *)p;
+    header_ = (const ResultHeader *)base_;
+
+    const ResultHeader &h = *header_;
+    bool ok = (memcmp(h.magic, result_magic, sizeof(h.magic)) == 0) && (h.version == result_version)
+      && (h.endian == result_endian) && (h.num_columns == RESULT_COLUMNS)
+      && (h.record_size == sizeof(ResultRecord) + h.num_columns*h.num_wavelengths*sizeof(double))
+      && (h.data_offset >= h.wavelength_offset + h.num_wavelengths*sizeof(double)) && (h.data_offset <= length_);
+    if (!ok) {
+      close();
+      return false;
+    }
+    num_records_ = (size_t)((length_ - h.data_offset)/h.record_size);
+    if ((h.num_records != 0) && (h.num_records < num_records_)) num_records_ = (size_t)h.num_records;
+    return true;
+  }
+
+  // Unmaps the file.
+  void close()
+  {
+    if (base_ != NULL) munmap((void *)base_, length_);
+    base_ = NULL;
+    header_ = NULL;
+    length_ = 0;
+    num_records_ = 0;
+  }
+
+  // Header of the file.
+  const ResultHeader &header() const { return *header_; }
+
+  // Number of spectra.
+  size_t size() const { return num_records_; }
+
+  // Number of wavelength points.
+  size_t wavelengths() const { return (size_t)header_->num_wavelengths; }
+
+  // Wavelengths in nm.
+  const double *lambda() const { return (const double *)(base_ + header_->wavelength_offset); }
+
+  // Parameters of the spectrum i.
+  const ResultRecord &record(
+    const size_t &i) const                  // Index of the spectrum in the file.
+  {
+    return *(const ResultRecord *)(base_ + header_->data_offset + i*header_->record_size);
+  }
+
+  // Column c of the spectrum i, wavelengths() values.
+  const double *column(
+    const size_t &i,                        // Index of the spectrum in the file.
+    const int &c) const                     // Column, one of ResultColumn.
+  {
+    return (const double *)(&record(i) + 1) + (size_t)c*header_->num_wavelengths;
+  }
+
+private:
+
+  const char *base_;                        // Beginning of the mapping.
+  size_t length_;                           // Length of the mapping.
+  const ResultHeader *header_;              // Header.
+  size_t num_records_;                      // Number of complete records.
+
+  ResultFile(const ResultFile &);
+  ResultFile &operator=(const ResultFile &);
+};
+
+/*----------------------------------------------------------------------------------------------------------------------
+  Query protocol of the server mode (triangle --server PATH) over a Unix domain stream socket. A client sends
+  QueryRequest structures, possibly several before reading the answers, and receives for each of them, in the
+  order of the requests of the connection, a QueryResponse followed by num_values doubles:
+    QUERY_GRID      - the wavelength grid of the server in nm;
+    QUERY_SPECTRUM  - Re(alpha), Im(alpha), C_sca, C_ext, C_abs on the grid, in the order of ResultColumn;
+    QUERY_RESONANCE - plasmon resonance in the range of the grid: its wavelength in nm (the zero of the real part
+                      of the denominator of the polarizability, or its maximum if there is none), C_sca, C_ext,
+                      C_abs there in cm^2 and the full width at half maximum in nm (NaN without a zero).
+  Numbers are in the byte order of the server machine.
+----------------------------------------------------------------------------------------------------------------------*/
+enum QueryType { QUERY_GRID = 0, QUERY_SPECTRUM = 1, QUERY_RESONANCE = 2 };
+enum QueryStatus { QUERY_OK = 0, QUERY_BAD_REQUEST = 1 };
+enum ResonanceValue { RESONANCE_LAMBDA, RESONANCE_C_SCA, RESONANCE_C_EXT, RESONANCE_C_ABS, RESONANCE_FWHM,
+                      RESONANCE_VALUES };
+
+struct QueryRequest
+{
+  uint64_t id;                              // Returned in the response.
+  uint32_t type;                            // One of QueryType.
+  int32_t is_silver;                        // Material: 1 - silver, 0 - gold.
+  double L;                                 // Edge length in nm.
+  double H;                                 // Thickness in nm.
+  double R;                                 // Triangle base corner radius in nm.
+  double eps_h;                             // Dielectric permittivity of host media.
+};
+
+static_assert(sizeof(QueryRequest) == 48, "QueryRequest must have the same layout on all platforms");
+
+struct QueryResponse
+{
+  uint64_t id;                              // Id of the request.
+  uint32_t status;                          // One of QueryStatus.
+  uint32_t num_values;                      // Number of doubles that follow.
+};
+
+static_assert(sizeof(QueryResponse) == 16, "QueryResponse must have the same layout on all platforms");
+
+#endif